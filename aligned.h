@@ -0,0 +1,211 @@
+#pragma once
+
+#include "unique.h"  // UniquePtr
+
+#include <algorithm>  // std::max
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>  // std::aligned_alloc, std::free
+#include <cstring>  // std::memset
+#include <limits>
+#include <memory>  // std::uninitialized_value_construct_n, std::uninitialized_default_construct_n
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+
+#if defined(__linux__)
+#include <sys/mman.h>  // mmap, munmap, madvise
+#endif
+
+// Buffers for vectorised code: `UniquePtr<T[]>` to memory aligned beyond what `new` guarantees,
+// or backed by huge pages. The deleters are stateless, so the pointers stay one word wide
+// (`CompressedPair` stores an empty deleter as a base). Having no room for the element count,
+// they don't run destructors: only trivially destructible `T` are allowed.
+
+// Frees memory of `MakeUniqueAligned`.
+struct AlignedFree {
+    void operator()(const void* ptr) const {
+        std::free(const_cast<void*>(ptr));
+    }
+};
+
+// Frees memory of `MakeUniqueHugePages`.
+struct HugePageFree {
+    void operator()(const void* ptr) const;
+};
+
+// Raw memory for the buffers, with overflow checked sizes.
+class AlignedMemory {
+public:
+    // `size` bytes aligned to `alignment`, which must be a power of two. Freed with `std::free`.
+    static void* Allocate(size_t size, size_t alignment) {
+        if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+            throw std::invalid_argument("alignment must be a power of two");
+        }
+        alignment = std::max(alignment, alignof(void*));
+        // `aligned_alloc` wants the size to be a multiple of the alignment.
+        void* ptr = std::aligned_alloc(alignment, RoundUp(std::max<size_t>(size, 1), alignment));
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    static size_t ArrayBytes(size_t n, size_t size) {
+        if (n > std::numeric_limits<size_t>::max() / size) {
+            throw std::bad_array_new_length();
+        }
+        return n * size;
+    }
+    static size_t RoundUp(size_t value, size_t alignment) {
+        if (value > std::numeric_limits<size_t>::max() - alignment) {
+            throw std::bad_array_new_length();
+        }
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+};
+
+// A huge-page backed mapping. The buffer starts one cache line into it, right after the header
+// that lets the stateless `HugePageFree` find the mapping again.
+class HugePages {
+public:
+    static constexpr size_t kHugePageSize = size_t(2) << 20;
+    static constexpr size_t kDataOffset = 64;
+
+    // Tries reserved huge pages first, then a 2 MiB aligned range with transparent huge pages
+    // requested, and settles for whatever pages that range gets. Where there is no `mmap`, or it
+    // fails (e.g. forbidden by a sandbox), takes heap memory instead. Memory comes zero-filled.
+    static void* Allocate(size_t size) {
+        Header mapping{nullptr, AlignedMemory::RoundUp(kDataOffset + size, kHugePageSize), true};
+        mapping.base = Map(mapping.length);
+        if (mapping.base == nullptr) {
+            mapping.length = AlignedMemory::RoundUp(kDataOffset + size, kDataOffset);
+            mapping.base = AlignedMemory::Allocate(mapping.length, kDataOffset);
+            mapping.mapped = false;
+            std::memset(mapping.base, 0, mapping.length);
+        }
+        auto* data = static_cast<unsigned char*>(mapping.base) + kDataOffset;
+        *reinterpret_cast<Header*>(data - sizeof(Header)) = mapping;
+        return data;
+    }
+    static void Free(void* ptr) {
+        auto* header = reinterpret_cast<Header*>(static_cast<unsigned char*>(ptr) - sizeof(Header));
+        if (header->mapped) {
+            Unmap(header->base, header->length);
+        } else {
+            std::free(header->base);
+        }
+    }
+
+private:
+    struct Header {
+        void* base;
+        size_t length;
+        // Whether `base` is a mapping rather than heap memory.
+        bool mapped;
+    };
+
+#if defined(__linux__)
+    // Null if nothing could be mapped.
+    static void* Map(size_t length) {
+        constexpr int kProtection = PROT_READ | PROT_WRITE;
+        constexpr int kFlags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_HUGETLB
+        void* base = mmap(nullptr, length, kProtection, kFlags | MAP_HUGETLB, -1, 0);
+        if (base != MAP_FAILED) {
+            return base;
+        }
+#endif
+        // Over-map by one huge page and trim, so the range can be covered by huge pages.
+        size_t padded = length + kHugePageSize;
+        void* raw = mmap(nullptr, padded, kProtection, kFlags, -1, 0);
+        if (raw == MAP_FAILED) {
+            return nullptr;
+        }
+        auto begin = reinterpret_cast<uintptr_t>(raw);
+        auto aligned = (begin + kHugePageSize - 1) & ~(kHugePageSize - 1);
+        if (aligned != begin) {
+            munmap(raw, aligned - begin);
+        }
+        if (aligned + length != begin + padded) {
+            munmap(reinterpret_cast<void*>(aligned + length), begin + padded - aligned - length);
+        }
+#ifdef MADV_HUGEPAGE
+        // Only a hint: without transparent huge pages the range stays on regular pages.
+        madvise(reinterpret_cast<void*>(aligned), length, MADV_HUGEPAGE);
+#endif
+        return reinterpret_cast<void*>(aligned);
+    }
+    static void Unmap(void* base, size_t length) {
+        munmap(base, length);
+    }
+#else
+    // No huge pages here: `Allocate` falls back to the heap.
+    static void* Map(size_t) {
+        return nullptr;
+    }
+    static void Unmap(void*, size_t) {
+    }
+#endif
+};
+
+inline void HugePageFree::operator()(const void* ptr) const {
+    HugePages::Free(const_cast<void*>(ptr));
+}
+
+// `n` value-initialised elements aligned to `alignment` (a power of two; at least `alignof(T)`
+// is used anyway), e.g. 64 for cache lines and AVX-512 loads.
+template <typename T>
+requires std::is_unbounded_array_v<T> UniquePtr<T, AlignedFree> MakeUniqueAligned(
+    size_t n, size_t alignment) {
+    using Element = std::remove_extent_t<T>;
+    static_assert(std::is_trivially_destructible_v<Element>);
+    void* memory = AlignedMemory::Allocate(AlignedMemory::ArrayBytes(n, sizeof(Element)),
+                                           std::max(alignment, alignof(Element)));
+    auto* elements = static_cast<Element*>(memory);
+    try {
+        std::uninitialized_value_construct_n(elements, n);
+    } catch (...) {
+        std::free(memory);
+        throw;
+    }
+    return UniquePtr<T, AlignedFree>(elements);
+}
+
+// Same, but default-initialised: trivial elements are left uninitialised.
+template <typename T>
+requires std::is_unbounded_array_v<T> UniquePtr<T, AlignedFree> MakeUniqueAlignedForOverwrite(
+    size_t n, size_t alignment) {
+    using Element = std::remove_extent_t<T>;
+    static_assert(std::is_trivially_destructible_v<Element>);
+    void* memory = AlignedMemory::Allocate(AlignedMemory::ArrayBytes(n, sizeof(Element)),
+                                           std::max(alignment, alignof(Element)));
+    auto* elements = static_cast<Element*>(memory);
+    try {
+        std::uninitialized_default_construct_n(elements, n);
+    } catch (...) {
+        std::free(memory);
+        throw;
+    }
+    return UniquePtr<T, AlignedFree>(elements);
+}
+
+// `n` default-initialised elements on huge pages when the system has them, on regular pages
+// otherwise (or heap memory where nothing can be mapped), aligned to a cache line. The memory
+// comes zero-filled, so trivial elements read as zero. Meant for large buffers: the mapping is
+// rounded up to 2 MiB.
+template <typename T>
+requires std::is_unbounded_array_v<T> UniquePtr<T, HugePageFree> MakeUniqueHugePages(size_t n) {
+    using Element = std::remove_extent_t<T>;
+    static_assert(std::is_trivially_destructible_v<Element>);
+    static_assert(alignof(Element) <= HugePages::kDataOffset);
+    void* memory = HugePages::Allocate(AlignedMemory::ArrayBytes(n, sizeof(Element)));
+    auto* elements = static_cast<Element*>(memory);
+    try {
+        std::uninitialized_default_construct_n(elements, n);
+    } catch (...) {
+        HugePages::Free(memory);
+        throw;
+    }
+    return UniquePtr<T, HugePageFree>(elements);
+}
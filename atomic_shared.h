@@ -0,0 +1,160 @@
+#pragma once
+
+#include "shared.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// https://en.cppreference.com/w/cpp/memory/shared_ptr/atomic2
+//
+// The slot is a single word: a pointer to an immutable node holding a `SharedPtr` in the low
+// 48 bits and the number of loads in flight on that node in the top 16 bits (split reference
+// counting). A load bumps the in-flight count with one fetch_add, copies the `SharedPtr` out of
+// the node and then gives its count back: either to the slot, if the node is still there, or to
+// the node itself, if it has been replaced meanwhile. Whoever replaces a node hands the in-flight
+// count it swapped out over to the node, and the node is freed once all of them are returned.
+//
+// Every operation is lock-free but none is wait-free: giving the count back is a CAS loop that
+// retries while other loads or writers change the slot under it, and so is a compare-exchange.
+// Each stored non-null value costs one node allocation. Relies on user-space addresses fitting
+// into 48 bits (x86-64, AArch64) and on fewer than 2^16 loads of the same slot being in flight at
+// once.
+template <typename T>
+class AtomicSharedPtr {
+    struct Node {
+        explicit Node(SharedPtr<T> value) : value(std::move(value)) {
+        }
+
+        SharedPtr<T> value;
+        // In-flight loads handed over when the node left the slot, minus the ones already done.
+        std::atomic<std::ptrdiff_t> pending = 0;
+    };
+
+    static_assert(sizeof(uintptr_t) == 8, "AtomicSharedPtr needs 64-bit pointers");
+    static_assert(std::atomic<uintptr_t>::is_always_lock_free);
+
+    static constexpr size_t kCountShift = 48;
+    static constexpr uintptr_t kOne = uintptr_t(1) << kCountShift;
+    static constexpr uintptr_t kPointerMask = kOne - 1;
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    AtomicSharedPtr() : word_(0) {
+    }
+    AtomicSharedPtr(SharedPtr<T> value) : word_(MakeWord(std::move(value))) {
+    }
+    AtomicSharedPtr(const AtomicSharedPtr&) = delete;
+    AtomicSharedPtr& operator=(const AtomicSharedPtr&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~AtomicSharedPtr() {
+        delete GetNode(word_.load(std::memory_order_acquire));
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Atomic operations
+
+    SharedPtr<T> Load() const {
+        Node* node = Acquire();
+        SharedPtr<T> result = node != nullptr ? node->value : SharedPtr<T>();
+        Release(node);
+        return result;
+    }
+    void Store(SharedPtr<T> desired) {
+        Exchange(std::move(desired));
+    }
+    SharedPtr<T> Exchange(SharedPtr<T> desired) {
+        uintptr_t old = word_.exchange(MakeWord(std::move(desired)), std::memory_order_acq_rel);
+        Node* node = GetNode(old);
+        if (node == nullptr) {
+            return SharedPtr<T>();
+        }
+        // Nobody reads `value` without an in-flight count, and the ones still running only copy it.
+        SharedPtr<T> result = node->value;
+        Retire(node, old);
+        return result;
+    }
+    // Replaces the value with `desired` if it is equivalent to `expected` (stores the same pointer
+    // and shares ownership with it). Otherwise loads the current value into `expected`.
+    bool CompareExchange(SharedPtr<T>& expected, SharedPtr<T> desired) {
+        uintptr_t desired_word = MakeWord(std::move(desired));
+        while (true) {
+            Node* node = Acquire();
+            if (!IsEquivalent(node, expected)) {
+                expected = node != nullptr ? node->value : SharedPtr<T>();
+                Release(node);
+                delete GetNode(desired_word);
+                return false;
+            }
+            uintptr_t word = word_.load(std::memory_order_relaxed);
+            while (GetNode(word) == node) {
+                if (word_.compare_exchange_weak(word, desired_word, std::memory_order_acq_rel,
+                                                std::memory_order_relaxed)) {
+                    if (node != nullptr) {
+                        Retire(node, word);
+                    }
+                    Release(node);
+                    return true;
+                }
+            }
+            // Replaced between our load and the swap: look at the new value.
+            Release(node);
+        }
+    }
+
+    bool IsLockFree() const {
+        return word_.is_lock_free();
+    }
+
+private:
+    static uintptr_t MakeWord(SharedPtr<T> value) {
+        if (!value) {
+            return 0;
+        }
+        return reinterpret_cast<uintptr_t>(new Node(std::move(value)));
+    }
+    static Node* GetNode(uintptr_t word) {
+        return reinterpret_cast<Node*>(word & kPointerMask);
+    }
+    static bool IsEquivalent(Node* node, const SharedPtr<T>& ptr) {
+        if (node == nullptr) {
+            return !ptr;
+        }
+        return node->value.block_ == ptr.block_ && node->value.observer_ == ptr.observer_;
+    }
+
+    // Protect the current node from being freed until `Release`.
+    Node* Acquire() const {
+        return GetNode(word_.fetch_add(kOne, std::memory_order_acquire));
+    }
+    void Release(Node* node) const {
+        uintptr_t word = word_.load(std::memory_order_relaxed);
+        // Counts on an empty slot protect nothing and are dropped when it is replaced.
+        // The slot may have been emptied again since, so only take back what is still there.
+        while (GetNode(word) == node && (node != nullptr || word >= kOne)) {
+            if (word_.compare_exchange_weak(word, word - kOne, std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+                return;
+            }
+        }
+        // Our count went away with the node, give it back to the node itself.
+        if (node != nullptr && node->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete node;
+        }
+    }
+    // `node` has just been swapped out of the slot along with the in-flight count of `word`.
+    static void Retire(Node* node, uintptr_t word) {
+        auto in_flight = static_cast<std::ptrdiff_t>(word >> kCountShift);
+        if (node->pending.fetch_add(in_flight, std::memory_order_acq_rel) + in_flight == 0) {
+            delete node;
+        }
+    }
+
+    mutable std::atomic<uintptr_t> word_;
+};
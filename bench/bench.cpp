@@ -0,0 +1,1321 @@
+// Microbenchmarks of the smart pointers, each next to its `std::` equivalent.
+//
+// Usage: smart_ptrs_bench [--quick] [filter]
+//   --quick  a hundredth of the operations and a single run, to check that everything works;
+//   filter   run only the groups whose name contains it.
+//
+// Every row is the fastest of a few runs: nanoseconds, heap allocations and allocated bytes
+// per operation. Allocations are counted by replacing the global `operator new`, so they
+// include the ones made by the objects themselves (e.g. a long `std::string`).
+// The library's compile-time options apply to a whole program, so the CMake build makes one
+// binary per option: `smart_ptrs_bench_pooled`, `_packed` and `_flat`.
+// The teardown group drops lists recursively on a thread stack of up to 1 GiB: 256 MiB for the
+// 10^6-node lists, about half of it touched. Longer lists skip the recursive rows.
+
+#include "aligned.h"
+#include "atomic_shared.h"
+#include "borrow.h"
+#include "compressed_pair.h"
+#include "hazard.h"
+#include "intrusive.h"
+#include "object_pool.h"
+#include "relocatable.h"
+#include "shared.h"
+#include "thin.h"
+#include "unique.h"
+#include "weak.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Allocation counting
+
+static std::atomic<size_t> allocations = 0;
+static std::atomic<size_t> allocated_bytes = 0;
+
+static void* CountedAllocate(size_t size, size_t alignment) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    size = std::max<size_t>(size, 1);
+    void* ptr = alignment <= alignof(std::max_align_t)
+                    ? std::malloc(size)
+                    : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+// The array and nothrow forms of the standard library forward to these.
+void* operator new(size_t size) {
+    return CountedAllocate(size, alignof(std::max_align_t));
+}
+void* operator new(size_t size, std::align_val_t alignment) {
+    return CountedAllocate(size, static_cast<size_t>(alignment));
+}
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Harness
+
+struct Stats {
+    double ns;
+    double allocations;
+    double bytes;
+};
+
+static bool quick = false;
+
+// Keeps the compiler from optimizing `value` (and the work that produced it) away.
+template <class T>
+static void Escape(const T& value) {
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+static size_t Scaled(size_t ops) {
+    return quick ? std::max<size_t>(ops / 100, 1) : ops;
+}
+
+// Run `setup` untimed, then `body`, which does `ops` operations; keep the fastest run.
+template <class Setup, class Body>
+static Stats Measure(size_t ops, Setup setup, Body body) {
+    Stats best{std::numeric_limits<double>::infinity(), 0, 0};
+    for (int run = 0, runs = quick ? 1 : 5; run < runs; ++run) {
+        setup();
+        size_t allocations_before = allocations.load(std::memory_order_relaxed);
+        size_t bytes_before = allocated_bytes.load(std::memory_order_relaxed);
+        auto start = std::chrono::steady_clock::now();
+        body();
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        best.ns = std::min(best.ns, elapsed.count() / ops);
+        best.allocations = double(allocations.load(std::memory_order_relaxed) - allocations_before);
+        best.allocations /= ops;
+        best.bytes = double(allocated_bytes.load(std::memory_order_relaxed) - bytes_before) / ops;
+    }
+    return best;
+}
+template <class Body>
+static Stats Measure(size_t ops, Body body) {
+    return Measure(ops, [] {}, body);
+}
+
+static void Report(const char* name, const char* impl, const Stats& stats) {
+    std::printf("%-34s %-35s %8.1f %10.2f %9.1f\n", name, impl, stats.ns, stats.allocations,
+                stats.bytes);
+}
+
+// Run `body` on `threads` threads at once and wait for all of them.
+template <class Body>
+static void OnThreads(int threads, Body body) {
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back(body);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// Run `body` on a thread with a stack of `bytes` and wait for it.
+template <class Body>
+static void OnLargeStack(size_t bytes, Body body) {
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, bytes);
+    auto run = [](void* argument) -> void* {
+        (*static_cast<Body*>(argument))();
+        return nullptr;
+    };
+    pthread_t thread;
+    if (int error = pthread_create(&thread, &attributes, run, &body); error != 0) {
+        std::fprintf(stderr, "cannot start a thread with a %zu-byte stack: %s\n", bytes,
+                     std::strerror(error));
+        std::abort();
+    }
+    pthread_join(thread, nullptr);
+    pthread_attr_destroy(&attributes);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Types
+
+struct Base {
+    virtual ~Base() = default;
+    int value = 0;
+};
+struct Derived : Base {
+    int extra = 0;
+};
+
+struct Triple {
+    int a = 0;
+    int b = 0;
+    int c = 0;
+};
+
+struct SimpleNode : SimpleRefCounted<SimpleNode> {
+    int value = 0;
+};
+struct AtomicNode : ThreadSafeRefCounted<AtomicNode> {
+    int value = 0;
+};
+
+// Longer than any small string buffer, so each message allocates its body too.
+struct Message {
+    std::string body = std::string(64, 'x');
+    int id = 0;
+};
+struct IntrusiveMessage : ThreadSafeRefCounted<IntrusiveMessage>, Message {};
+struct PooledMessage : ThreadSafeRefCounted<PooledMessage, PoolDelete>, Message {};
+
+struct StoredSelf : EnableSharedFromThis<StoredSelf> {
+    int value = 0;
+};
+struct LocatedSelf : EnableSharedFromThis<LocatedSelf, LocateBlock> {
+    int value = 0;
+};
+struct StdSelf : std::enable_shared_from_this<StdSelf> {
+    int value = 0;
+};
+
+template <template <class> class Ptr>
+struct ListNode {
+    Ptr<ListNode> next;
+};
+template <class D>
+struct IntrusiveListNode : ThreadSafeRefCounted<IntrusiveListNode<D>, D> {
+    IntrusivePtr<IntrusiveListNode> next;
+};
+// Readers walk the list through `next` with hazard pointers; `next_owner` keeps the rest alive.
+struct HazardNode : ThreadSafeRefCounted<HazardNode, HazardDelete<>> {
+    int value = 1;
+    std::atomic<HazardNode*> next = nullptr;
+    IntrusivePtr<HazardNode> next_owner;
+};
+struct CountedNode : ThreadSafeRefCounted<CountedNode> {
+    int value = 1;
+    IntrusivePtr<CountedNode> next;
+};
+struct StdNode {
+    int value = 1;
+    std::shared_ptr<StdNode> next;
+};
+template <template <class> class Ptr>
+struct TreeNode {
+    Ptr<TreeNode> left;
+    Ptr<TreeNode> right;
+};
+
+// The same object in a block of each layout.
+template <class Layout>
+struct LaidOut {
+    int value = 0;
+};
+template <class Layout>
+struct BlockLayoutOf<LaidOut<Layout>> {
+    using Type = Layout;
+};
+
+template <class T>
+using FlatUniquePtr = UniquePtr<T, FlatSlug<T>>;
+template <class T>
+using StdUniquePtr = std::unique_ptr<T>;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Cases
+
+static void BenchConstruct() {
+    size_t n = Scaled(1'000'000);
+    Report("construct from new int", "SharedPtr", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   SharedPtr<int> ptr(new int(1));
+                   Escape(ptr);
+               }
+           }));
+    Report("", "std::shared_ptr", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   std::shared_ptr<int> ptr(new int(1));
+                   Escape(ptr);
+               }
+           }));
+    Report("construct from new Derived", "SharedPtr<Base>", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   SharedPtr<Base> ptr(new Derived());
+                   Escape(ptr);
+               }
+           }));
+    Report("", "std::shared_ptr<Base>", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   std::shared_ptr<Base> ptr(new Derived());
+                   Escape(ptr);
+               }
+           }));
+}
+
+static void BenchMake() {
+    size_t n = Scaled(1'000'000);
+    Report("make int", "MakeShared", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto ptr = MakeShared<int>(1);
+                   Escape(ptr);
+               }
+           }));
+    Report("", "std::make_shared", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto ptr = std::make_shared<int>(1);
+                   Escape(ptr);
+               }
+           }));
+    Report("", "MakeUnique", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto ptr = MakeUnique<int>(1);
+                   Escape(ptr);
+               }
+           }));
+    Report("", "std::make_unique", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto ptr = std::make_unique<int>(1);
+                   Escape(ptr);
+               }
+           }));
+    Report("make struct of 3 ints", "MakeShared", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto ptr = MakeShared<Triple>();
+                   Escape(ptr);
+               }
+           }));
+    Report("", "MakeSharedBiased", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto ptr = MakeSharedBiased<Triple>();
+                   Escape(ptr);
+               }
+           }));
+    Report("", "std::make_shared", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto ptr = std::make_shared<Triple>();
+                   Escape(ptr);
+               }
+           }));
+    Report("make intrusive node", "MakeIntrusive SimpleRefCounted", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto ptr = MakeIntrusive<SimpleNode>();
+                   Escape(ptr);
+               }
+           }));
+    Report("", "MakeIntrusive ThreadSafeRefCounted", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto ptr = MakeIntrusive<AtomicNode>();
+                   Escape(ptr);
+               }
+           }));
+    Report("make message (64-byte string)", "MakeIntrusive", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto ptr = MakeIntrusive<IntrusiveMessage>();
+                   Escape(ptr);
+               }
+           }));
+    Report("", "MakeIntrusive PoolDelete", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto ptr = MakeIntrusive<PooledMessage>();
+                   Escape(ptr);
+               }
+           }));
+    Report("", "std::make_shared", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto ptr = std::make_shared<Message>();
+                   Escape(ptr);
+               }
+           }));
+}
+
+static void BenchCopy() {
+    size_t n = Scaled(10'000'000);
+    auto shared = MakeShared<int>(1);
+    Report("copy+drop", "SharedPtr<int>", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   SharedPtr<int> copy(shared);
+                   Escape(copy);
+               }
+           }));
+    auto biased = MakeSharedBiased<int>(1);
+    Report("", "SharedPtr<int> biased, owner", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   SharedPtr<int> copy(biased);
+                   Escape(copy);
+               }
+           }));
+    SharedPtr<Base> base(new Derived());
+    Report("", "SharedPtr<Base>", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   SharedPtr<Base> copy(base);
+                   Escape(copy);
+               }
+           }));
+    // The two counter policies: a plain `SimpleCounter` against `AtomicCounter`.
+    auto simple = MakeIntrusive<SimpleNode>();
+    Report("", "IntrusivePtr SimpleRefCounted", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   IntrusivePtr<SimpleNode> copy(simple);
+                   Escape(copy);
+               }
+           }));
+    auto atomic = MakeIntrusive<AtomicNode>();
+    Report("", "IntrusivePtr ThreadSafeRefCounted", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   IntrusivePtr<AtomicNode> copy(atomic);
+                   Escape(copy);
+               }
+           }));
+    auto thin = MakeThinShared<int>(1);
+    Report("", "ThinSharedPtr<int>", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   ThinSharedPtr<int> copy(thin);
+                   Escape(copy);
+               }
+           }));
+    auto std_shared = std::make_shared<int>(1);
+    Report("", "std::shared_ptr<int>", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   std::shared_ptr<int> copy(std_shared);
+                   Escape(copy);
+               }
+           }));
+}
+
+static void BenchMove() {
+    size_t n = Scaled(10'000'000);
+    auto shared = MakeShared<int>(1);
+    Report("move there and back", "SharedPtr", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   SharedPtr<int> moved(std::move(shared));
+                   shared = std::move(moved);
+                   Escape(shared);
+               }
+           }));
+    auto std_shared = std::make_shared<int>(1);
+    Report("", "std::shared_ptr", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   std::shared_ptr<int> moved(std::move(std_shared));
+                   std_shared = std::move(moved);
+                   Escape(std_shared);
+               }
+           }));
+    auto unique = MakeUnique<int>(1);
+    Report("", "UniquePtr", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   UniquePtr<int> moved(std::move(unique));
+                   unique = std::move(moved);
+                   Escape(unique);
+               }
+           }));
+    auto std_unique = std::make_unique<int>(1);
+    Report("", "std::unique_ptr", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   std::unique_ptr<int> moved(std::move(std_unique));
+                   std_unique = std::move(moved);
+                   Escape(std_unique);
+               }
+           }));
+}
+
+static void BenchReset() {
+    size_t n = Scaled(1'000'000);
+    SharedPtr<int> shared;
+    Report("Reset(new int)", "SharedPtr", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   shared.Reset(new int(1));
+                   Escape(shared);
+               }
+           }));
+    std::shared_ptr<int> std_shared;
+    Report("", "std::shared_ptr", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   std_shared.reset(new int(1));
+                   Escape(std_shared);
+               }
+           }));
+    UniquePtr<int> unique;
+    Report("", "UniquePtr", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   unique.Reset(new int(1));
+                   Escape(unique);
+               }
+           }));
+    std::unique_ptr<int> std_unique;
+    Report("", "std::unique_ptr", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   std_unique.reset(new int(1));
+                   Escape(std_unique);
+               }
+           }));
+}
+
+static void BenchLock() {
+    size_t n = Scaled(10'000'000);
+    auto shared = MakeShared<int>(1);
+    WeakPtr<int> weak(shared);
+    Report("WeakPtr lock+drop", "WeakPtr::Lock", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto locked = weak.Lock();
+                   Escape(locked);
+               }
+           }));
+    auto std_shared = std::make_shared<int>(1);
+    std::weak_ptr<int> std_weak(std_shared);
+    Report("", "std::weak_ptr::lock", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto locked = std_weak.lock();
+                   Escape(locked);
+               }
+           }));
+    auto biased = MakeSharedBiased<int>(1);
+    WeakPtr<int> biased_weak(biased);
+    Report("", "WeakPtr::Lock biased, owner", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto locked = biased_weak.Lock();
+                   Escape(locked);
+               }
+           }));
+}
+
+static void BenchSharedFromThis() {
+    size_t n = Scaled(10'000'000);
+    auto stored = MakeShared<StoredSelf>();
+    Report("SharedFromThis+drop", "StoreWeakThis", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto self = stored->SharedFromThis();
+                   Escape(self);
+               }
+           }));
+    auto located = MakeShared<LocatedSelf>();
+    Report("", "LocateBlock", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto self = located->SharedFromThis();
+                   Escape(self);
+               }
+           }));
+    auto std_self = std::make_shared<StdSelf>();
+    Report("", "std::enable_shared_from_this", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto self = std_self->shared_from_this();
+                   Escape(self);
+               }
+           }));
+    n = Scaled(1'000'000);
+    Report("make with SharedFromThis", "StoreWeakThis", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto ptr = MakeShared<StoredSelf>();
+                   Escape(ptr);
+               }
+           }));
+    Report("", "LocateBlock", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto ptr = MakeShared<LocatedSelf>();
+                   Escape(ptr);
+               }
+           }));
+    Report("", "std::enable_shared_from_this", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   auto ptr = std::make_shared<StdSelf>();
+                   Escape(ptr);
+               }
+           }));
+}
+
+static void BenchAlias() {
+    size_t n = Scaled(10'000'000);
+    auto shared = MakeShared<Triple>();
+    Report("aliasing construct+drop", "SharedPtr", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   SharedPtr<int> member(shared, &shared->b);
+                   Escape(member);
+               }
+           }));
+    auto std_shared = std::make_shared<Triple>();
+    Report("", "std::shared_ptr", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   std::shared_ptr<int> member(std_shared, &std_shared->b);
+                   Escape(member);
+               }
+           }));
+}
+
+// Out of line, so that the argument is really passed and dropped on every call.
+[[gnu::noinline]] static int ReadShared(SharedPtr<int> ptr) {
+    return *ptr;
+}
+[[gnu::noinline]] static int ReadSharedByReference(const SharedPtr<int>& ptr) {
+    return *ptr;
+}
+[[gnu::noinline]] static int ReadSharedRef(SharedRef<int> ref) {
+    return *ref;
+}
+[[gnu::noinline]] static int ReadStdShared(std::shared_ptr<int> ptr) {
+    return *ptr;
+}
+
+static void BenchBorrow() {
+    size_t n = Scaled(10'000'000);
+    auto shared = MakeShared<int>(1);
+    Report("call taking the pointer", "SharedPtr by value", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   int value = ReadShared(shared);
+                   Escape(value);
+               }
+           }));
+    Report("", "const SharedPtr&", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   int value = ReadSharedByReference(shared);
+                   Escape(value);
+               }
+           }));
+    Report("", "SharedRef", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   int value = ReadSharedRef(shared);
+                   Escape(value);
+               }
+           }));
+    auto std_shared = std::make_shared<int>(1);
+    Report("", "std::shared_ptr by value", Measure(n, [&] {
+               for (size_t i = 0; i < n; ++i) {
+                   int value = ReadStdShared(std_shared);
+                   Escape(value);
+               }
+           }));
+}
+
+// Fills vectors of 1000 copies from empty, growth included.
+static void BenchVectorPush() {
+    constexpr size_t kSize = 1000;
+    size_t n = Scaled(10'000'000) / kSize * kSize;
+    auto shared = MakeShared<int>(1);
+    Report("vector push of copies", "RelocatingVector<SharedPtr>", Measure(n, [&] {
+               for (size_t i = 0; i < n; i += kSize) {
+                   RelocatingVector<SharedPtr<int>> vector;
+                   for (size_t j = 0; j < kSize; ++j) {
+                       vector.PushBack(shared);
+                   }
+                   Escape(vector);
+               }
+           }));
+    Report("", "std::vector<SharedPtr>", Measure(n, [&] {
+               for (size_t i = 0; i < n; i += kSize) {
+                   std::vector<SharedPtr<int>> vector;
+                   for (size_t j = 0; j < kSize; ++j) {
+                       vector.push_back(shared);
+                   }
+                   Escape(vector);
+               }
+           }));
+    auto std_shared = std::make_shared<int>(1);
+    Report("", "std::vector<std::shared_ptr>", Measure(n, [&] {
+               for (size_t i = 0; i < n; i += kSize) {
+                   std::vector<std::shared_ptr<int>> vector;
+                   for (size_t j = 0; j < kSize; ++j) {
+                       vector.push_back(std_shared);
+                   }
+                   Escape(vector);
+               }
+           }));
+}
+
+// Sorts pointers by the values they point to; per element.
+template <class Ptr, class Make>
+static Stats MeasureSort(size_t n, Make make) {
+    std::vector<Ptr> pointers;
+    std::mt19937 random(42);
+    return Measure(
+        n,
+        [&] {
+            pointers.clear();
+            for (size_t i = 0; i < n; ++i) {
+                pointers.push_back(make(static_cast<int>(random())));
+            }
+        },
+        [&] {
+            std::sort(pointers.begin(), pointers.end(),
+                      [](const Ptr& lhs, const Ptr& rhs) { return *lhs < *rhs; });
+            Escape(pointers);
+        });
+}
+
+static void BenchSort() {
+    size_t n = Scaled(1'000'000);
+    Report("sort by pointee", "SharedPtr",
+           MeasureSort<SharedPtr<int>>(n, [](int value) { return MakeShared<int>(value); }));
+    Report("", "ThinSharedPtr", MeasureSort<ThinSharedPtr<int>>(n, [](int value) {
+               return MakeThinShared<int>(value);
+           }));
+    Report("", "std::shared_ptr", MeasureSort<std::shared_ptr<int>>(n, [](int value) {
+               return std::make_shared<int>(value);
+           }));
+    Report("", "UniquePtr",
+           MeasureSort<UniquePtr<int>>(n, [](int value) { return MakeUnique<int>(value); }));
+    Report("", "std::unique_ptr", MeasureSort<std::unique_ptr<int>>(n, [](int value) {
+               return std::make_unique<int>(value);
+           }));
+}
+
+// Drops the head of a list of `n` nodes; per node.
+template <class Make>
+static Stats MeasureListTeardown(size_t n, Make make) {
+    decltype(make()) head;
+    return Measure(
+        n,
+        [&] {
+            for (size_t i = 0; i < n; ++i) {
+                auto node = make();
+                node->next = std::move(head);
+                head = std::move(node);
+            }
+        },
+        [&] {
+            decltype(make()) dropped(std::move(head));
+            Escape(dropped);
+        });
+}
+
+template <template <class> class Ptr>
+static Ptr<TreeNode<Ptr>> BuildTree(int depth) {
+    Ptr<TreeNode<Ptr>> node(new TreeNode<Ptr>());
+    if (depth > 0) {
+        node->left = BuildTree<Ptr>(depth - 1);
+        node->right = BuildTree<Ptr>(depth - 1);
+    }
+    return node;
+}
+
+// Drops the root of a full binary tree of `2^(depth + 1) - 1` nodes; per node.
+template <template <class> class Ptr>
+static Stats MeasureTreeTeardown(int depth) {
+    Ptr<TreeNode<Ptr>> root;
+    return Measure(
+        (size_t(2) << depth) - 1, [&] { root = BuildTree<Ptr>(depth); },
+        [&] {
+            Ptr<TreeNode<Ptr>> dropped(std::move(root));
+            Escape(dropped);
+        });
+}
+
+// The smallest depth of a full binary tree with at least `n` nodes.
+static int TreeDepth(size_t n) {
+    int depth = 0;
+    while ((size_t(2) << depth) - 1 < n) {
+        ++depth;
+    }
+    return depth;
+}
+
+// The recursive teardowns take a few stack frames per list node, far more than the default
+// stack holds for the long lists: they run on a thread with `kStackPerNode` bytes per node, but
+// no more than `kMaxStack`. Lists too long for that are only dropped by the flat teardowns
+// (`FlatSlug`, `FlatDelete` and `SMART_PTRS_FLAT_TEARDOWN`, see `smart_ptrs_bench_flat`), and the
+// recursive rows say they were skipped: the 10^7-node lists would need 2.4 GiB of stack.
+static constexpr size_t kStackPerNode = 256;
+static constexpr size_t kMaxStack = size_t(1) << 30;
+
+#ifdef SMART_PTRS_FLAT_TEARDOWN
+static constexpr bool kFlatSharedPtr = true;
+#else
+static constexpr bool kFlatSharedPtr = false;
+#endif
+
+static void BenchTeardown() {
+    for (size_t n : {Scaled(1'000'000), Scaled(10'000'000)}) {
+        std::string name = "drop list of " + std::to_string(n);
+        const size_t stack = n * kStackPerNode;
+        // Report `measure()`, unless it recurses over the list and the stack would be too large.
+        auto report = [&](const char* impl, bool recursive, auto measure) {
+            if (recursive && stack > kMaxStack) {
+                std::printf("%-34s %-35s skipped: needs %zu MiB of stack\n", name.c_str(), impl,
+                            stack >> 20);
+            } else {
+                Report(name.c_str(), impl, measure());
+            }
+            name.clear();
+        };
+        OnLargeStack(std::min(stack, kMaxStack), [&] {
+            report("UniquePtr", true, [&] {
+                return MeasureListTeardown(n, [] {
+                    return UniquePtr<ListNode<UniquePtr>>(new ListNode<UniquePtr>());
+                });
+            });
+            report("UniquePtr FlatSlug", false, [&] {
+                return MeasureListTeardown(n, [] {
+                    return FlatUniquePtr<ListNode<FlatUniquePtr>>(new ListNode<FlatUniquePtr>());
+                });
+            });
+            report("std::unique_ptr", true, [&] {
+                return MeasureListTeardown(
+                    n, [] { return std::make_unique<ListNode<StdUniquePtr>>(); });
+            });
+            report("SharedPtr", !kFlatSharedPtr, [&] {
+                return MeasureListTeardown(n, [] { return MakeShared<ListNode<SharedPtr>>(); });
+            });
+            report("std::shared_ptr", true, [&] {
+                return MeasureListTeardown(
+                    n, [] { return std::make_shared<ListNode<std::shared_ptr>>(); });
+            });
+            report("IntrusivePtr", true, [&] {
+                return MeasureListTeardown(
+                    n, [] { return MakeIntrusive<IntrusiveListNode<DefaultDelete>>(); });
+            });
+            report("IntrusivePtr FlatDelete", false, [&] {
+                return MeasureListTeardown(
+                    n, [] { return MakeIntrusive<IntrusiveListNode<FlatDelete<>>>(); });
+            });
+        });
+        int depth = TreeDepth(n);
+        name = "drop tree of " + std::to_string((size_t(2) << depth) - 1);
+        Report(name.c_str(), "UniquePtr", MeasureTreeTeardown<UniquePtr>(depth));
+        Report("", "UniquePtr FlatSlug", MeasureTreeTeardown<FlatUniquePtr>(depth));
+        Report("", "std::unique_ptr", MeasureTreeTeardown<StdUniquePtr>(depth));
+    }
+}
+
+// Makes a buffer of `size` elements and writes all of it, page faults included; per element.
+// Huge pages take one fault per 2 MiB instead of one per 4 KiB.
+template <class Make>
+static Stats MeasureFill(size_t size, Make make) {
+    return Measure(size, [&] {
+        auto buffer = make(size);
+        for (size_t i = 0; i < size; ++i) {
+            buffer[i] = static_cast<uint32_t>(i);
+        }
+        Escape(buffer);
+    });
+}
+
+// Reads of random elements of a written buffer of `size` elements, a power of two; per read.
+// Beyond what the TLB covers with 4 KiB pages, nearly every read misses it.
+template <class Make>
+static Stats MeasureRandomReads(size_t size, Make make) {
+    auto buffer = make(size);
+    for (size_t i = 0; i < size; ++i) {
+        buffer[i] = static_cast<uint32_t>(i);
+    }
+    size_t n = Scaled(10'000'000);
+    return Measure(n, [&] {
+        uint32_t sum = 0;
+        uint32_t index = 1;
+        for (size_t i = 0; i < n; ++i) {
+            index = index * 1664525 + 1013904223;
+            sum += buffer[index & (size - 1)];
+        }
+        Escape(sum);
+    });
+}
+
+static void BenchAligned() {
+    // 256 MiB of `uint32_t`, far beyond the TLB reach of regular pages.
+    size_t size = quick ? size_t(1) << 20 : size_t(1) << 26;
+    auto make_unique = [](size_t n) { return MakeUnique<uint32_t[]>(n); };
+    auto make_aligned = [](size_t n) { return MakeUniqueAligned<uint32_t[]>(n, 64); };
+    auto make_huge = [](size_t n) { return MakeUniqueHugePages<uint32_t[]>(n); };
+    Report("make and fill buffer", "MakeUnique<T[]>", MeasureFill(size, make_unique));
+    Report("", "MakeUniqueAligned, 64", MeasureFill(size, make_aligned));
+    Report("", "MakeUniqueHugePages", MeasureFill(size, make_huge));
+    Report("random reads from buffer", "MakeUnique<T[]>", MeasureRandomReads(size, make_unique));
+    Report("", "MakeUniqueAligned, 64", MeasureRandomReads(size, make_aligned));
+    Report("", "MakeUniqueHugePages", MeasureRandomReads(size, make_huge));
+}
+
+// Every thread copies and drops the same pointer: the counter's cache line bounces between
+// the cores. Per copy, over all threads.
+template <class Ptr>
+static Stats MeasureContendedCopy(const Ptr& shared, int threads) {
+    size_t n = Scaled(2'000'000) / threads * threads;
+    return Measure(n, [&] {
+        OnThreads(threads, [&] {
+            for (size_t i = 0; i < n / threads; ++i) {
+                Ptr copy(shared);
+                Escape(copy);
+            }
+        });
+    });
+}
+
+template <class Weak>
+static Stats MeasureContendedLock(const Weak& weak, int threads) {
+    size_t n = Scaled(2'000'000) / threads * threads;
+    return Measure(n, [&] {
+        OnThreads(threads, [&] {
+            for (size_t i = 0; i < n / threads; ++i) {
+                auto locked = weak.lock();
+                Escape(locked);
+            }
+        });
+    });
+}
+
+// Objects made on one thread and dropped on another, e.g. handed over through a queue.
+template <class Ptr, class Make>
+static Stats MeasureHandOver(Make make) {
+    size_t n = Scaled(1'000'000);
+    std::vector<Ptr> pointers;
+    pointers.reserve(n);
+    return Measure(n, [&] {
+        std::thread([&] {
+            for (size_t i = 0; i < n; ++i) {
+                pointers.push_back(make());
+            }
+        }).join();
+        std::thread([&] { pointers.clear(); }).join();
+    });
+}
+
+// Lets `MeasureContendedLock` call both.
+struct LockableWeakPtr : WeakPtr<int> {
+    using WeakPtr<int>::WeakPtr;
+    SharedPtr<int> lock() const {
+        return Lock();
+    }
+};
+
+static void BenchThreads() {
+    auto shared = MakeShared<int>(1);
+    auto std_shared = std::make_shared<int>(1);
+    auto atomic = MakeIntrusive<AtomicNode>();
+    LockableWeakPtr weak(shared);
+    std::weak_ptr<int> std_weak(std_shared);
+    for (int threads : {1, 2, 4}) {
+        std::string name = "copy+drop on " + std::to_string(threads) + " thread(s)";
+        Report(name.c_str(), "SharedPtr", MeasureContendedCopy(shared, threads));
+        Report("", "IntrusivePtr ThreadSafeRefCounted", MeasureContendedCopy(atomic, threads));
+        Report("", "std::shared_ptr", MeasureContendedCopy(std_shared, threads));
+        name = "lock+drop on " + std::to_string(threads) + " thread(s)";
+        Report(name.c_str(), "WeakPtr::Lock", MeasureContendedLock(weak, threads));
+        Report("", "std::weak_ptr::lock", MeasureContendedLock(std_weak, threads));
+    }
+    Report("make here, drop on another thread", "MakeShared",
+           MeasureHandOver<SharedPtr<Triple>>([] { return MakeShared<Triple>(); }));
+    Report("", "std::make_shared",
+           MeasureHandOver<std::shared_ptr<Triple>>([] { return std::make_shared<Triple>(); }));
+}
+
+// `ops` times `main` on this thread while `threads` others run `background` over and over.
+// Per `main`.
+template <class Main, class Background>
+static Stats MeasureAgainst(size_t ops, int threads, Main main, Background background) {
+    return Measure(ops, [&] {
+        std::atomic<bool> done = false;
+        std::vector<std::thread> workers;
+        for (int i = 0; i < threads; ++i) {
+            workers.emplace_back([&] {
+                while (!done.load(std::memory_order_relaxed)) {
+                    background();
+                }
+            });
+        }
+        for (size_t i = 0; i < ops; ++i) {
+            main();
+        }
+        done.store(true, std::memory_order_relaxed);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    });
+}
+
+// One thread writes to the object while the others copy and drop the pointer: with the counters
+// on the object's cache line, every copy takes the line away from the writer.
+template <class Ptr>
+static Stats MeasureWriteAgainstCopies(const Ptr& shared, int threads) {
+    auto* object = shared.get();
+    return MeasureAgainst(
+        Scaled(10'000'000), threads,
+        [&] {
+            ++object->value;
+            Escape(object->value);
+        },
+        [&] {
+            Ptr copy(shared);
+            Escape(copy);
+        });
+}
+
+// One thread copies and drops the pointer while the others do the same with a `WeakPtr`:
+// only `SplitLayout` keeps the two counters on separate lines.
+template <class Layout>
+static Stats MeasureCopyAgainstWeak(int threads) {
+    auto shared = MakeShared<LaidOut<Layout>>();
+    WeakPtr<LaidOut<Layout>> weak(shared);
+    return MeasureAgainst(
+        Scaled(10'000'000), threads,
+        [&] {
+            SharedPtr<LaidOut<Layout>> copy(shared);
+            Escape(copy);
+        },
+        [&] {
+            WeakPtr<LaidOut<Layout>> copy(weak);
+            Escape(copy);
+        });
+}
+
+// Lets `MeasureWriteAgainstCopies` call both.
+template <class Layout>
+struct LaidOutPtr : SharedPtr<LaidOut<Layout>> {
+    using SharedPtr<LaidOut<Layout>>::SharedPtr;
+    LaidOut<Layout>* get() const {
+        return this->Get();
+    }
+};
+
+template <class Layout>
+static LaidOutPtr<Layout> MakeLaidOut() {
+    return LaidOutPtr<Layout>(MakeShared<LaidOut<Layout>>());
+}
+
+// Needs as many cores as threads to show anything: on one core the threads take turns.
+static void BenchLayout() {
+    std::printf("block bytes around an int: colocated %zu, padded %zu, split %zu\n",
+                sizeof(BlockObject<LaidOut<ColocatedLayout>>),
+                sizeof(BlockObject<LaidOut<PaddedLayout>>),
+                sizeof(BlockObject<LaidOut<SplitLayout>>));
+    for (int threads : {1, 3}) {
+        std::string name = "write while " + std::to_string(threads) + " copy";
+        Report(name.c_str(), "ColocatedLayout",
+               MeasureWriteAgainstCopies(MakeLaidOut<ColocatedLayout>(), threads));
+        Report("", "PaddedLayout", MeasureWriteAgainstCopies(MakeLaidOut<PaddedLayout>(), threads));
+        Report("", "SplitLayout", MeasureWriteAgainstCopies(MakeLaidOut<SplitLayout>(), threads));
+        Report("", "std::make_shared",
+               MeasureWriteAgainstCopies(std::make_shared<LaidOut<void>>(), threads));
+        name = "copy while " + std::to_string(threads) + " copy WeakPtr";
+        Report(name.c_str(), "ColocatedLayout", MeasureCopyAgainstWeak<ColocatedLayout>(threads));
+        Report("", "PaddedLayout", MeasureCopyAgainstWeak<PaddedLayout>(threads));
+        Report("", "SplitLayout", MeasureCopyAgainstWeak<SplitLayout>(threads));
+    }
+}
+
+// A list that readers walk with hazard pointers while a writer may replace its first node.
+struct HazardList {
+    explicit HazardList(size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            auto node = MakeIntrusive<HazardNode>();
+            node->next.store(first_owner.Get(), std::memory_order_relaxed);
+            node->next_owner = std::move(first_owner);
+            first_owner = std::move(node);
+        }
+        first.store(first_owner.Get(), std::memory_order_release);
+    }
+    ~HazardList() {
+        first_owner.Reset();
+        HazardDomain::Default().Reclaim();
+    }
+
+    // The old node is retired, and reclaimed once no reader is on it.
+    void ReplaceFirst() {
+        auto fresh = MakeIntrusive<HazardNode>();
+        fresh->next.store(first_owner->next.load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+        fresh->next_owner = first_owner->next_owner;
+        first.store(fresh.Get(), std::memory_order_release);
+        first_owner = std::move(fresh);
+    }
+    // Hand over hand: the next node is protected before the current one is let go.
+    int Sum() const {
+        HazardPointer current;
+        HazardPointer next;
+        int sum = 0;
+        for (HazardNode* node = current.Protect(first); node != nullptr;) {
+            sum += node->value;
+            HazardNode* successor = next.Protect(node->next);
+            current.Swap(next);
+            node = successor;
+        }
+        return sum;
+    }
+
+    std::atomic<HazardNode*> first = nullptr;
+    IntrusivePtr<HazardNode> first_owner;
+};
+
+template <class Ptr, class Make>
+static Ptr MakeList(size_t size, Make make) {
+    Ptr first;
+    for (size_t i = 0; i < size; ++i) {
+        Ptr node = make();
+        node->next = std::move(first);
+        first = std::move(node);
+    }
+    return first;
+}
+
+// Holds a reference to each node it visits, as a reader without hazard pointers must.
+template <class Ptr>
+static int SumCounted(const Ptr& first) {
+    int sum = 0;
+    for (Ptr node = first; node; node = node->next) {
+        sum += node->value;
+    }
+    return sum;
+}
+
+// `threads` readers walk a list `walks` times each.
+template <class Walk>
+static void WalkOnThreads(int threads, size_t walks, Walk walk) {
+    OnThreads(threads, [&] {
+        for (size_t i = 0; i < walks; ++i) {
+            int sum = walk();
+            Escape(sum);
+        }
+    });
+}
+
+// `threads` readers walk a list of `size` nodes over and over, while `writer` runs
+// every 10 microseconds on one more thread if given. Per node visited.
+template <class Walk, class Writer>
+static Stats MeasureWalks(size_t size, int threads, Walk walk, Writer writer) {
+    size_t walks = std::max<size_t>(Scaled(10'000'000) / size / threads, 1);
+    return Measure(walks * size * threads, [&] {
+        std::atomic<bool> done = false;
+        std::thread writing([&] {
+            while (!done.load(std::memory_order_relaxed)) {
+                writer();
+                std::this_thread::sleep_for(std::chrono::microseconds(10));
+            }
+        });
+        WalkOnThreads(threads, walks, walk);
+        done.store(true, std::memory_order_relaxed);
+        writing.join();
+    });
+}
+template <class Walk>
+static Stats MeasureWalks(size_t size, int threads, Walk walk) {
+    size_t walks = std::max<size_t>(Scaled(10'000'000) / size / threads, 1);
+    return Measure(walks * size * threads, [&] { WalkOnThreads(threads, walks, walk); });
+}
+
+// Read-mostly linked list: readers protect each node with a hazard pointer instead of
+// taking a reference to it, so their walks write nothing shared.
+static void BenchHazard() {
+    constexpr size_t kSize = 1000;
+    HazardList hazard_list(kSize);
+    auto counted = MakeList<IntrusivePtr<CountedNode>>(kSize, [] {
+        return MakeIntrusive<CountedNode>();
+    });
+    auto std_list =
+        MakeList<std::shared_ptr<StdNode>>(kSize, [] { return std::make_shared<StdNode>(); });
+    for (int threads : {1, 2, 4}) {
+        std::string name = "walk list on " + std::to_string(threads) + " thread(s)";
+        Report(name.c_str(), "HazardPointer",
+               MeasureWalks(kSize, threads, [&] { return hazard_list.Sum(); }));
+        Report("", "HazardPointer, writer replacing",
+               MeasureWalks(
+                   kSize, threads, [&] { return hazard_list.Sum(); },
+                   [&] { hazard_list.ReplaceFirst(); }));
+        Report("", "IntrusivePtr ThreadSafeRefCounted",
+               MeasureWalks(kSize, threads, [&] { return SumCounted(counted); }));
+        Report("", "std::shared_ptr",
+               MeasureWalks(kSize, threads, [&] { return SumCounted(std_list); }));
+    }
+}
+
+// Every thread loads the same slot and drops the copy. Per load, over all threads.
+template <class Slot>
+static Stats MeasureContendedLoad(const Slot& slot, int threads) {
+    size_t n = Scaled(2'000'000) / threads * threads;
+    return Measure(n, [&] {
+        OnThreads(threads, [&] {
+            for (size_t i = 0; i < n / threads; ++i) {
+                auto loaded = slot.Load();
+                Escape(loaded);
+            }
+        });
+    });
+}
+
+// What `AtomicSharedPtr` replaces: a `SharedPtr` behind a mutex.
+struct MutexSharedPtr {
+    explicit MutexSharedPtr(SharedPtr<int> value) : value(std::move(value)) {
+    }
+    SharedPtr<int> Load() const {
+        std::lock_guard lock(mutex);
+        return value;
+    }
+    void Store(SharedPtr<int> desired) {
+        std::lock_guard lock(mutex);
+        value.Swap(desired);
+    }
+
+    mutable std::mutex mutex;
+    SharedPtr<int> value;
+};
+
+#ifdef __cpp_lib_atomic_shared_ptr
+// Lets `MeasureContendedLoad` call it.
+struct StdAtomicSharedPtr {
+    explicit StdAtomicSharedPtr(std::shared_ptr<int> value) : value(std::move(value)) {
+    }
+    std::shared_ptr<int> Load() const {
+        return value.load();
+    }
+    void Store(std::shared_ptr<int> desired) {
+        value.store(std::move(desired));
+    }
+
+    std::atomic<std::shared_ptr<int>> value;
+};
+#endif
+
+// Readers against readers, then against one thread storing new values. A load from
+// `AtomicSharedPtr` is a fetch_add on the slot plus the copy's own increment; the mutex puts a
+// lock and an unlock on top of the copy.
+static void BenchAtomicShared() {
+    MutexSharedPtr locked(MakeShared<int>(1));
+    AtomicSharedPtr<int> atomic(MakeShared<int>(1));
+#ifdef __cpp_lib_atomic_shared_ptr
+    StdAtomicSharedPtr std_atomic(std::make_shared<int>(1));
+#endif
+    int max_threads = std::max(4, static_cast<int>(std::thread::hardware_concurrency()));
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        std::string name = "load+drop on " + std::to_string(threads) + " thread(s)";
+        Report(name.c_str(), "AtomicSharedPtr::Load", MeasureContendedLoad(atomic, threads));
+        Report("", "SharedPtr under std::mutex", MeasureContendedLoad(locked, threads));
+#ifdef __cpp_lib_atomic_shared_ptr
+        Report("", "std::atomic<std::shared_ptr>", MeasureContendedLoad(std_atomic, threads));
+#endif
+    }
+    auto loads_against_store = [](auto& slot, auto make) {
+        return MeasureAgainst(
+            Scaled(2'000'000), 1,
+            [&] {
+                auto loaded = slot.Load();
+                Escape(loaded);
+            },
+            [&] { slot.Store(make()); });
+    };
+    Report("load+drop against a store", "AtomicSharedPtr::Load",
+           loads_against_store(atomic, [] { return MakeShared<int>(2); }));
+    Report("", "SharedPtr under std::mutex",
+           loads_against_store(locked, [] { return MakeShared<int>(2); }));
+#ifdef __cpp_lib_atomic_shared_ptr
+    Report("", "std::atomic<std::shared_ptr>",
+           loads_against_store(std_atomic, [] { return std::make_shared<int>(2); }));
+#endif
+}
+
+// Heap bytes per object of `make()`, averaged over a batch: pooled blocks come in slabs.
+template <class Make>
+static double BytesPerObject(Make make) {
+    constexpr size_t kObjects = 1024;
+    std::vector<decltype(make())> objects;
+    objects.reserve(kObjects);
+    size_t before = allocated_bytes.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < kObjects; ++i) {
+        objects.push_back(make());
+    }
+    return double(allocated_bytes.load(std::memory_order_relaxed) - before) / kObjects;
+}
+
+static void PrintSizes() {
+#ifdef SMART_PTRS_POOLED_BLOCKS
+    // Create the pool's depot, so that it doesn't count against the first blocks.
+    BlockPool::Free(BlockPool::Allocate(1), 1);
+#endif
+    std::printf("sizes, bytes: SharedPtr %zu (std %zu), WeakPtr %zu (std %zu), "
+                "ThinSharedPtr %zu, ThinWeakPtr %zu,\n  UniquePtr %zu (std %zu), "
+                "CompressedPair<int*, Slug<int>> %zu (std::pair<int*, std::default_delete<int>> "
+                "%zu),\n",
+                sizeof(SharedPtr<int>), sizeof(std::shared_ptr<int>), sizeof(WeakPtr<int>),
+                sizeof(std::weak_ptr<int>), sizeof(ThinSharedPtr<int>), sizeof(ThinWeakPtr<int>),
+                sizeof(UniquePtr<int>), sizeof(std::unique_ptr<int>),
+                sizeof(CompressedPair<int*, Slug<int>>),
+                sizeof(std::pair<int*, std::default_delete<int>>));
+    std::printf("  MakeShared<int> block %zu (counters %zu), allocated per object %.1f "
+                "(std::make_shared %.1f)\n\n",
+                sizeof(BlockObject<int>), sizeof(BaseBlock),
+                BytesPerObject([] { return MakeShared<int>(); }),
+                BytesPerObject([] { return std::make_shared<int>(); }));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Group {
+    const char* name;
+    void (*run)();
+};
+
+static constexpr Group kGroups[] = {
+    {"construct", &BenchConstruct},
+    {"make", &BenchMake},
+    {"copy", &BenchCopy},
+    {"move", &BenchMove},
+    {"reset", &BenchReset},
+    {"lock", &BenchLock},
+    {"shared_from_this", &BenchSharedFromThis},
+    {"alias", &BenchAlias},
+    {"borrow", &BenchBorrow},
+    {"vector", &BenchVectorPush},
+    {"sort", &BenchSort},
+    {"teardown", &BenchTeardown},
+    {"aligned", &BenchAligned},
+    {"threads", &BenchThreads},
+    {"hazard", &BenchHazard},
+    {"layout", &BenchLayout},
+    {"atomic_shared", &BenchAtomicShared},
+};
+
+int main(int argc, char** argv) {
+    const char* filter = "";
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+        } else {
+            filter = argv[i];
+        }
+    }
+    // libstdc++ counts with plain arithmetic until the process starts a thread. Start one,
+    // so that every `std::shared_ptr` row pays for the atomics like `SharedPtr` does.
+    std::thread([] {}).join();
+    std::printf("options:");
+#ifdef SMART_PTRS_POOLED_BLOCKS
+    std::printf(" SMART_PTRS_POOLED_BLOCKS");
+#endif
+#ifdef SMART_PTRS_PACKED_COUNTERS
+    std::printf(" SMART_PTRS_PACKED_COUNTERS");
+#endif
+#ifdef SMART_PTRS_FLAT_TEARDOWN
+    std::printf(" SMART_PTRS_FLAT_TEARDOWN");
+#endif
+    std::printf("\n");
+    PrintSizes();
+    std::printf("%-34s %-35s %8s %10s %9s\n", "group / case", "implementation", "ns/op",
+                "allocs/op", "bytes/op");
+    for (const Group& group : kGroups) {
+        if (std::strstr(group.name, filter) != nullptr) {
+            std::printf("[%s]\n", group.name);
+            group.run();
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include "thread_local_cache.h"
+
+#include <cstddef>
+#include <memory>  // std::allocator
+#include <mutex>
+#include <new>
+
+// Size-class pool for control blocks and other small allocations.
+//
+// Every thread keeps a free list per size class and serves allocations from it without locks.
+// A block freed by another thread simply joins that thread's list. When a list grows past
+// `2 * kBatch`, `kBatch` blocks go to the global depot; an empty list refills with a batch from
+// the depot, or carves a fresh slab of `kBatch` blocks if the depot is empty too. So blocks
+// flow from the threads that free them back to the threads that allocate them in batches,
+// and steady-state churn doesn't touch malloc at all.
+//
+// Memory is never given back to the system: the pool keeps its high-water mark. Recycled blocks
+// are also invisible to AddressSanitizer, so leave the pool off in sanitizer builds.
+class BlockPool {
+public:
+    // Blocks are aligned to and rounded up to `kGranularity` bytes.
+    static constexpr size_t kGranularity = 16;
+    static constexpr size_t kMaxSize = 256;
+    static constexpr size_t kBatch = 64;
+
+    static bool Fits(size_t size, size_t alignment) {
+        return size <= kMaxSize && alignment <= kGranularity;
+    }
+
+    // `size` must fit.
+    static void* Allocate(size_t size) {
+        size_t size_class = GetSizeClass(size);
+        Cache* cache = GetCache();
+        if (cache == nullptr) {
+            return GetDepot().TakeOne(size_class);
+        }
+        FreeList& list = cache->lists[size_class];
+        if (list.head == nullptr) {
+            GetDepot().Refill(size_class, list);
+        }
+        return list.Pop();
+    }
+    static void Free(void* ptr, size_t size) {
+        size_t size_class = GetSizeClass(size);
+        Cache* cache = GetCache();
+        if (cache == nullptr) {
+            GetDepot().PutOne(size_class, ptr);
+            return;
+        }
+        FreeList& list = cache->lists[size_class];
+        list.Push(ptr);
+        if (list.count > 2 * kBatch) {
+            GetDepot().Flush(size_class, list, kBatch);
+        }
+    }
+
+private:
+    static constexpr size_t kSizeClasses = kMaxSize / kGranularity;
+
+    struct Node {
+        Node* next;
+    };
+    struct FreeList {
+        void Push(void* ptr) {
+            auto* node = static_cast<Node*>(ptr);
+            node->next = head;
+            head = node;
+            ++count;
+        }
+        void* Pop() {
+            Node* node = head;
+            head = node->next;
+            --count;
+            return node;
+        }
+
+        Node* head = nullptr;
+        size_t count = 0;
+    };
+
+    // Per-thread lists. Handed over to the depot when the thread exits; frees that happen on
+    // the thread after that (from other thread-local destructors) go to the depot directly.
+    struct Cache {
+        ~Cache() {
+            for (size_t size_class = 0; size_class < kSizeClasses; ++size_class) {
+                FreeList& list = lists[size_class];
+                GetDepot().Flush(size_class, list, list.count);
+            }
+        }
+        FreeList lists[kSizeClasses];
+    };
+
+    class Depot {
+    public:
+        // Move up to `kBatch` blocks into the empty `list`, carving a new slab if there are none.
+        void Refill(size_t size_class, FreeList& list) {
+            {
+                std::lock_guard lock(mutexes_[size_class]);
+                FreeList& shared = lists_[size_class];
+                while (shared.head != nullptr && list.count < kBatch) {
+                    list.Push(shared.Pop());
+                }
+            }
+            if (list.head == nullptr) {
+                size_t size = GetClassSize(size_class);
+                auto* slab = static_cast<unsigned char*>(::operator new(kBatch * size));
+                for (size_t i = kBatch; i != 0; --i) {
+                    list.Push(slab + (i - 1) * size);
+                }
+            }
+        }
+        // Move `count` blocks from `list` to the depot.
+        void Flush(size_t size_class, FreeList& list, size_t count) {
+            std::lock_guard lock(mutexes_[size_class]);
+            FreeList& shared = lists_[size_class];
+            for (size_t i = 0; i < count; ++i) {
+                shared.Push(list.Pop());
+            }
+        }
+        void* TakeOne(size_t size_class) {
+            {
+                std::lock_guard lock(mutexes_[size_class]);
+                FreeList& shared = lists_[size_class];
+                if (shared.head != nullptr) {
+                    return shared.Pop();
+                }
+            }
+            return ::operator new(GetClassSize(size_class));
+        }
+        void PutOne(size_t size_class, void* ptr) {
+            std::lock_guard lock(mutexes_[size_class]);
+            lists_[size_class].Push(ptr);
+        }
+
+    private:
+        std::mutex mutexes_[kSizeClasses];
+        FreeList lists_[kSizeClasses];
+    };
+
+    static size_t GetSizeClass(size_t size) {
+        return size == 0 ? 0 : (size - 1) / kGranularity;
+    }
+    static size_t GetClassSize(size_t size_class) {
+        return (size_class + 1) * kGranularity;
+    }
+    static Cache* GetCache() {
+        return ThreadLocalCache<Cache>::Get();
+    }
+    // Never destroyed: blocks may be freed during static destruction.
+    static Depot& GetDepot() {
+        static Depot* depot = new Depot();
+        return *depot;
+    }
+};
+
+// Stateless allocator that takes small requests from `BlockPool` and passes the rest
+// to `std::allocator`. Pass it to `AllocateShared` or a `SharedPtr` constructor, or define
+// `SMART_PTRS_POOLED_BLOCKS` to make it the default for control blocks.
+template <class T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    PoolAllocator() = default;
+    template <class U>
+    PoolAllocator(const PoolAllocator<U>&) {
+    }
+
+    T* allocate(size_t n) {
+        if (IsPooled(n)) {
+            return static_cast<T*>(BlockPool::Allocate(n * sizeof(T)));
+        }
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* ptr, size_t n) {
+        if (IsPooled(n)) {
+            BlockPool::Free(ptr, n * sizeof(T));
+            return;
+        }
+        std::allocator<T>().deallocate(ptr, n);
+    }
+
+    template <class U>
+    bool operator==(const PoolAllocator<U>&) const {
+        return true;
+    }
+
+private:
+    static bool IsPooled(size_t n) {
+        return n <= BlockPool::kMaxSize / sizeof(T) && BlockPool::Fits(n * sizeof(T), alignof(T));
+    }
+};
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#if defined(__GNUG__)
+#include <cxxabi.h>  // for abi::__cxa_demangle
+#include <cstdlib>   // for std::free
+#endif
+
+// Per-type statistics of `SharedPtr` control blocks.
+// Collected only when compiled with `SMART_PTRS_BLOCK_STATS` defined; otherwise control blocks
+// don't touch them at all and the snapshot is empty.
+//
+// The reference a block is created with counts as a strong increment, so the increments and
+// decrements of a freed block match. Failed `WeakPtr::Lock`s count as nothing.
+//
+// Lifetimes are measured from the creation of the block to the destruction of the object and
+// bucketed by powers of two: bucket `i` counts lifetimes in [2^i, 2^(i+1)) nanoseconds.
+
+struct BlockStatsSnapshot {
+    static constexpr size_t kLifetimeBuckets = 48;
+
+    std::string type_name;
+    uint64_t live_blocks = 0;
+    uint64_t peak_live_blocks = 0;
+    uint64_t allocations = 0;
+    uint64_t strong_inc = 0;
+    uint64_t strong_dec = 0;
+    uint64_t weak_inc = 0;
+    uint64_t weak_dec = 0;
+    std::array<uint64_t, kLifetimeBuckets> lifetime_ns_log2 = {};
+};
+
+class BlockStats {
+    static constexpr size_t kLifetimeBuckets = BlockStatsSnapshot::kLifetimeBuckets;
+
+public:
+    template <typename T>
+    static BlockStats& For() {
+        static BlockStats* stats = Register(typeid(T).name());
+        return *stats;
+    }
+
+    static int64_t Now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    void OnAllocate() {
+        allocations_.fetch_add(1, std::memory_order_relaxed);
+        strong_inc_.fetch_add(1, std::memory_order_relaxed);
+        uint64_t live = live_.fetch_add(1, std::memory_order_relaxed) + 1;
+        uint64_t peak = peak_.load(std::memory_order_relaxed);
+        while (live > peak && !peak_.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+        }
+    }
+    void OnFree() {
+        live_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    void OnObjectDestroyed(int64_t created_ns) {
+        auto lifetime = static_cast<uint64_t>(Now() - created_ns);
+        size_t bucket = 0;
+        while (bucket + 1 < kLifetimeBuckets && (lifetime >> (bucket + 1)) != 0) {
+            ++bucket;
+        }
+        lifetime_[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+    void OnStrongInc() {
+        strong_inc_.fetch_add(1, std::memory_order_relaxed);
+    }
+    void OnStrongDec() {
+        strong_dec_.fetch_add(1, std::memory_order_relaxed);
+    }
+    void OnWeakInc() {
+        weak_inc_.fetch_add(1, std::memory_order_relaxed);
+    }
+    void OnWeakDec() {
+        weak_dec_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    BlockStatsSnapshot Snapshot() const {
+        BlockStatsSnapshot result;
+        result.type_name = type_name_;
+        result.live_blocks = live_.load(std::memory_order_relaxed);
+        result.peak_live_blocks = peak_.load(std::memory_order_relaxed);
+        result.allocations = allocations_.load(std::memory_order_relaxed);
+        result.strong_inc = strong_inc_.load(std::memory_order_relaxed);
+        result.strong_dec = strong_dec_.load(std::memory_order_relaxed);
+        result.weak_inc = weak_inc_.load(std::memory_order_relaxed);
+        result.weak_dec = weak_dec_.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < kLifetimeBuckets; ++i) {
+            result.lifetime_ns_log2[i] = lifetime_[i].load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    // Statistics of every type that had a block created so far.
+    static std::vector<BlockStatsSnapshot> SnapshotAll() {
+        std::vector<BlockStatsSnapshot> result;
+        Registry& registry = GetRegistry();
+        std::lock_guard lock(registry.mutex);
+        for (const BlockStats* stats : registry.all) {
+            result.push_back(stats->Snapshot());
+        }
+        return result;
+    }
+
+private:
+    struct Registry {
+        std::mutex mutex;
+        std::vector<const BlockStats*> all;
+    };
+
+    explicit BlockStats(std::string type_name) : type_name_(std::move(type_name)) {
+    }
+
+    static std::string Demangle(const char* name) {
+#if defined(__GNUG__)
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+        if (status == 0 && demangled != nullptr) {
+            std::string result(demangled);
+            std::free(demangled);
+            return result;
+        }
+#endif
+        return name;
+    }
+
+    // Stats are never freed: blocks may outlive static destruction.
+    static Registry& GetRegistry() {
+        static Registry* registry = new Registry();
+        return *registry;
+    }
+    static BlockStats* Register(const char* type_name) {
+        auto* stats = new BlockStats(Demangle(type_name));
+        Registry& registry = GetRegistry();
+        std::lock_guard lock(registry.mutex);
+        registry.all.push_back(stats);
+        return stats;
+    }
+
+    const std::string type_name_;
+    std::atomic<uint64_t> live_ = 0;
+    std::atomic<uint64_t> peak_ = 0;
+    std::atomic<uint64_t> allocations_ = 0;
+    std::atomic<uint64_t> strong_inc_ = 0;
+    std::atomic<uint64_t> strong_dec_ = 0;
+    std::atomic<uint64_t> weak_inc_ = 0;
+    std::atomic<uint64_t> weak_dec_ = 0;
+    std::array<std::atomic<uint64_t>, kLifetimeBuckets> lifetime_ = {};
+};
+
+inline std::vector<BlockStatsSnapshot> GetBlockStats() {
+    return BlockStats::SnapshotAll();
+}
+
+// One line per type, followed by the non-empty lifetime buckets.
+inline void DumpBlockStats(std::ostream& out) {
+    for (const BlockStatsSnapshot& stats : GetBlockStats()) {
+        out << stats.type_name << ": live " << stats.live_blocks << ", peak "
+            << stats.peak_live_blocks << ", allocations " << stats.allocations << ", strong +"
+            << stats.strong_inc << "/-" << stats.strong_dec << ", weak +" << stats.weak_inc << "/-"
+            << stats.weak_dec << '\n';
+        for (size_t i = 0; i < BlockStatsSnapshot::kLifetimeBuckets; ++i) {
+            if (stats.lifetime_ns_log2[i] != 0) {
+                out << "    lifetime >= 2^" << i << " ns: " << stats.lifetime_ns_log2[i] << '\n';
+            }
+        }
+    }
+}
@@ -0,0 +1,229 @@
+#pragma once
+
+#include "intrusive.h"
+#include "relocatable.h"
+#include "shared.h"
+
+#include <cstddef>  // std::nullptr_t
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+// Thrown by the checks of `SMART_PTRS_CHECK_BORROWS` builds when a borrowed object is used
+// after its last owner has gone.
+class DanglingRef : public std::exception {};
+
+// Borrowed, non-owning view of what a `SharedPtr` owns: the object and its control block,
+// without touching the counters. Pass it by value instead of `SharedPtr<T>` (an inc/dec pair
+// per call) or `const SharedPtr<T>&` (one more indirection): it is two trivially copyable
+// words, so it travels in registers. A callee that wants to keep the object calls
+// `ToShared()`, which costs a single increment.
+//
+// Like a reference, it must not outlive the `SharedPtr` it was made from. A temporary one, as
+// in `f(MakeShared<T>())`, lives until the end of the call, so passing one is fine, but keeping
+// the borrow in a variable leaves it dangling. With `SMART_PTRS_CHECK_BORROWS` defined, a
+// borrow holds a weak reference to the block, and every access throws `DanglingRef` if the
+// object is already dead.
+template <typename T>
+class SharedRef {
+    template <typename Y>
+    friend class SharedRef;
+
+public:
+    using ElementType = std::remove_extent_t<T>;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    SharedRef() : block_(nullptr), observer_(nullptr) {
+    }
+    SharedRef(std::nullptr_t) : block_(nullptr), observer_(nullptr) {
+    }
+    template <class Y>
+    requires IsCompatiblePointer<Y, T>::value SharedRef(const SharedPtr<Y>& ptr)
+        : block_(ptr.block_), observer_(ptr.observer_) {
+        Attach();
+    }
+    template <class Y>
+    requires IsCompatiblePointer<Y, T>::value SharedRef(const SharedRef<Y>& other)
+        : block_(other.block_), observer_(other.observer_) {
+        Attach();
+    }
+#ifdef SMART_PTRS_CHECK_BORROWS
+    SharedRef(const SharedRef& other) : block_(other.block_), observer_(other.observer_) {
+        Attach();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    SharedRef& operator=(const SharedRef& other) {
+        SharedRef(other).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~SharedRef() {
+        if (block_ != nullptr) {
+            block_->DecWeakCounter();
+        }
+    }
+#endif
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Swap(SharedRef& other) noexcept {
+        std::swap(block_, other.block_);
+        std::swap(observer_, other.observer_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Conversions
+
+    // An owning pointer to the same object, aliasing included. With the checks, testing for
+    // a live object and taking the reference are one step, so a dead object is never revived
+    // by a last owner going away on another thread in between.
+    SharedPtr<T> ToShared() const {
+        SharedPtr<T> result;
+        if (block_ == nullptr) {
+            return result;
+        }
+#ifdef SMART_PTRS_CHECK_BORROWS
+        if (!block_->IncStrongCounterIfNotZero()) {
+            throw DanglingRef();
+        }
+#else
+        block_->IncStrongCounter();
+#endif
+        result.block_ = block_;
+        result.observer_ = observer_;
+        return result;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    ElementType* Get() const {
+        Check();
+        return observer_;
+    }
+    T& operator*() const requires(!std::is_array_v<T>) {
+        return *Get();
+    }
+    T* operator->() const requires(!std::is_array_v<T>) {
+        return Get();
+    }
+    ElementType& operator[](std::ptrdiff_t index) const requires std::is_array_v<T> {
+        return Get()[index];
+    }
+    size_t UseCount() const {
+        if (block_ != nullptr) {
+            return block_->GetStrongCounter();
+        }
+        return 0;
+    }
+    explicit operator bool() const {
+        return block_ != nullptr;
+    }
+
+private:
+    void Attach() {
+#ifdef SMART_PTRS_CHECK_BORROWS
+        if (block_ != nullptr) {
+            block_->IncWeakCounter();
+        }
+#endif
+    }
+    void Check() const {
+#ifdef SMART_PTRS_CHECK_BORROWS
+        if (block_ != nullptr && block_->GetStrongCounter() == 0) {
+            throw DanglingRef();
+        }
+#endif
+    }
+
+    BaseBlock* block_;
+    ElementType* observer_;
+};
+
+template <typename T>
+struct IsTriviallyRelocatable<SharedRef<T>> : std::true_type {};
+
+template <typename T, typename U>
+inline bool operator==(const SharedRef<T>& left, const SharedRef<U>& right) {
+    return left.Get() == right.Get();
+}
+
+// Borrowed, non-owning view of an object owned by `IntrusivePtr`s. The counter lives in the
+// object, so this is just the pointer, but typed to say that the callee doesn't own it, and
+// `ToIntrusive()` is the one place where it takes a reference. The same as for `SharedRef`
+// goes for borrowing from a temporary `IntrusivePtr`: fine for a call, dangling if kept.
+//
+// With `SMART_PTRS_CHECK_BORROWS` defined, every access throws `DanglingRef` if the counter of
+// the object has dropped to zero. That reads the object, so it only catches a dead object
+// whose memory has not been reused yet (AddressSanitizer reports the rest).
+template <typename T>
+class IntrusiveRef {
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    IntrusiveRef() : object_(nullptr) {
+    }
+    IntrusiveRef(std::nullptr_t) : object_(nullptr) {
+    }
+    template <class Y>
+    requires std::is_convertible_v<Y*, T*> IntrusiveRef(const IntrusivePtr<Y>& ptr)
+        : object_(ptr.Get()) {
+    }
+    template <class Y>
+    requires std::is_convertible_v<Y*, T*> IntrusiveRef(const IntrusiveRef<Y>& other)
+        : object_(other.Get()) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Conversions
+
+    IntrusivePtr<T> ToIntrusive() const {
+        T* object = Get();
+        return object != nullptr ? IntrusivePtr<T>(object) : IntrusivePtr<T>();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const {
+#ifdef SMART_PTRS_CHECK_BORROWS
+        if (object_ != nullptr && object_->RefCount() == 0) {
+            throw DanglingRef();
+        }
+#endif
+        return object_;
+    }
+    T& operator*() const {
+        return *Get();
+    }
+    T* operator->() const {
+        return Get();
+    }
+    size_t UseCount() const {
+        if (object_ != nullptr) {
+            return object_->RefCount();
+        }
+        return 0;
+    }
+    explicit operator bool() const {
+        return object_ != nullptr;
+    }
+
+private:
+    T* object_;
+};
+
+template <typename T, typename U>
+inline bool operator==(const IntrusiveRef<T>& left, const IntrusiveRef<U>& right) {
+    return left.Get() == right.Get();
+}
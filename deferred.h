@@ -0,0 +1,113 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Objects whose destruction was deferred by their last owner: the owner only pushes them here,
+// and they are destroyed in batches later, either by `DrainDeferred()` called at a quiet point
+// or by a background reclaimer thread. Moves teardown of large object graphs off the thread that
+// happened to drop the last reference.
+class DeferredQueue {
+public:
+    using DestroyFunc = void (*)(void*);
+
+    // The process-wide queue. Never destroyed, so objects may be deferred during static
+    // destruction too (they just won't be destroyed unless somebody drains the queue).
+    static DeferredQueue& Default() {
+        static DeferredQueue* queue = new DeferredQueue();
+        return *queue;
+    }
+
+    void Push(void* object, DestroyFunc destroy) {
+        bool was_empty;
+        {
+            std::lock_guard lock(mutex_);
+            was_empty = items_.empty();
+            items_.push_back({object, destroy});
+        }
+        if (was_empty) {
+            wake_.notify_one();
+        }
+    }
+
+    // Destroy everything queued so far, and whatever those destructors defer in turn.
+    // Returns the number of destroyed objects.
+    size_t Drain() {
+        size_t count = 0;
+        std::vector<Item> batch;
+        while (TakeBatch(batch)) {
+            for (const Item& item : batch) {
+                item.destroy(item.object);
+            }
+            count += batch.size();
+            batch.clear();
+        }
+        return count;
+    }
+
+    // Start a thread that drains the queue whenever it is not empty. Does nothing if it runs.
+    void StartReclaimer() {
+        std::lock_guard lock(mutex_);
+        if (reclaimer_.joinable()) {
+            return;
+        }
+        stop_ = false;
+        reclaimer_ = std::thread([this] { RunReclaimer(); });
+    }
+    // Stop the reclaimer thread after it destroys what is queued at the moment.
+    void StopReclaimer() {
+        std::thread reclaimer;
+        {
+            std::lock_guard lock(mutex_);
+            stop_ = true;
+            reclaimer = std::move(reclaimer_);
+        }
+        wake_.notify_one();
+        if (reclaimer.joinable()) {
+            reclaimer.join();
+        }
+    }
+
+private:
+    struct Item {
+        void* object;
+        DestroyFunc destroy;
+    };
+
+    DeferredQueue() = default;
+
+    bool TakeBatch(std::vector<Item>& batch) {
+        std::lock_guard lock(mutex_);
+        batch.swap(items_);
+        return !batch.empty();
+    }
+    void RunReclaimer() {
+        std::unique_lock lock(mutex_);
+        while (true) {
+            wake_.wait(lock, [this] { return stop_ || !items_.empty(); });
+            if (stop_) {
+                break;
+            }
+            lock.unlock();
+            Drain();
+            lock.lock();
+        }
+        lock.unlock();
+        Drain();
+    }
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::vector<Item> items_;
+    std::thread reclaimer_;
+    bool stop_ = false;
+};
+
+// Destroy every deferred object now. Returns the number of destroyed objects.
+inline size_t DrainDeferred() {
+    return DeferredQueue::Default().Drain();
+}
@@ -0,0 +1,242 @@
+#pragma once
+
+#include "intrusive.h"
+#include "thread_local_cache.h"
+
+#include <algorithm>  // for std::sort / std::binary_search
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Hazard pointers: https://en.cppreference.com/w/cpp/experimental/hazard_pointer
+//
+// Readers publish the address they are about to dereference in a hazard record instead of
+// taking a reference. Objects whose last reference is gone are retired rather than destroyed,
+// and each thread reclaims its retired objects in batches, skipping the ones that are still
+// published by somebody.
+class HazardDomain {
+public:
+    struct Record {
+        std::atomic<const void*> pointer = nullptr;
+        std::atomic<bool> active = false;
+        Record* next = nullptr;
+    };
+    using ReclaimFunc = void (*)(void*);
+
+    // The process-wide domain. Never destroyed, so retiring stays safe during static destruction.
+    // Objects retired by a thread whose retire list is already gone (from thread-local or
+    // static destructors) become orphans, reclaimed by the next `Reclaim()` of any thread.
+    static HazardDomain& Default() {
+        static HazardDomain* domain = new HazardDomain();
+        return *domain;
+    }
+
+    // Records are reused but never freed: a reader may be scanning them at any time.
+    Record* AcquireRecord() {
+        for (Record* record = records_.load(std::memory_order_acquire); record != nullptr;
+             record = record->next) {
+            bool expected = false;
+            if (!record->active.load(std::memory_order_relaxed) &&
+                record->active.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                return record;
+            }
+        }
+        auto* record = new Record();
+        record->active.store(true, std::memory_order_relaxed);
+        record->next = records_.load(std::memory_order_relaxed);
+        while (!records_.compare_exchange_weak(record->next, record, std::memory_order_release,
+                                               std::memory_order_relaxed)) {
+        }
+        record_count_.fetch_add(1, std::memory_order_relaxed);
+        return record;
+    }
+    void ReleaseRecord(Record* record) {
+        record->pointer.store(nullptr, std::memory_order_release);
+        record->active.store(false, std::memory_order_release);
+    }
+
+    // Destroy `object` with `reclaim` once no hazard record points at it.
+    void Retire(void* object, ReclaimFunc reclaim) {
+        std::vector<Retired>* list = GetRetireList();
+        if (list == nullptr) {
+            std::lock_guard lock(orphans_mutex_);
+            orphans_.push_back({object, reclaim});
+            return;
+        }
+        list->push_back({object, reclaim});
+        if (list->size() >= ScanThreshold()) {
+            Reclaim();
+        }
+    }
+
+    // Reclaim what this thread (and exited threads) retired and nobody protects anymore.
+    // Reclaiming an object may retire more (dropping the references it holds). Those were
+    // retired after the scan, so a reader may have protected them since: they get a scan of
+    // their own, in the same call. Dropping a chain frees all of it, at one scan per link.
+    void Reclaim() {
+        if (reclaiming_) {
+            return;  // The outer call on this thread takes care of what is retired meanwhile.
+        }
+        reclaiming_ = true;
+        std::vector<Retired> items;
+        {
+            std::lock_guard lock(orphans_mutex_);
+            items.swap(orphans_);
+        }
+        std::vector<Retired> kept;
+        for (TakeRetired(items); !items.empty(); TakeRetired(items)) {
+            std::vector<const void*> hazards = ScanHazards();
+            for (const Retired& item : items) {
+                if (std::binary_search(hazards.begin(), hazards.end(), item.object)) {
+                    kept.push_back(item);
+                } else {
+                    item.reclaim(item.object);
+                }
+            }
+            items.clear();
+        }
+        reclaiming_ = false;
+        if (std::vector<Retired>* list = GetRetireList()) {
+            list->insert(list->end(), kept.begin(), kept.end());
+        } else {
+            std::lock_guard lock(orphans_mutex_);
+            orphans_.insert(orphans_.end(), kept.begin(), kept.end());
+        }
+    }
+
+private:
+    struct Retired {
+        void* object;
+        ReclaimFunc reclaim;
+    };
+    // Per-thread retire list. What is left at thread exit is handed over to the domain and
+    // reclaimed by others; objects retired on the thread after that go to the domain directly.
+    struct RetireList {
+        ~RetireList() {
+            if (!items.empty()) {
+                HazardDomain& domain = Default();
+                std::lock_guard lock(domain.orphans_mutex_);
+                domain.orphans_.insert(domain.orphans_.end(), items.begin(), items.end());
+            }
+        }
+        std::vector<Retired> items;
+    };
+
+    static constexpr size_t kMinScanThreshold = 64;
+
+    HazardDomain() = default;
+
+    // Move the objects retired on this thread, or as orphans once its list is gone, to `items`.
+    void TakeRetired(std::vector<Retired>& items) {
+        if (std::vector<Retired>* list = GetRetireList()) {
+            items.insert(items.end(), list->begin(), list->end());
+            list->clear();
+        } else {
+            std::lock_guard lock(orphans_mutex_);
+            items.insert(items.end(), orphans_.begin(), orphans_.end());
+            orphans_.clear();
+        }
+    }
+    // The pointers published by readers, sorted.
+    std::vector<const void*> ScanHazards() const {
+        // Pairs with the fence in `HazardPointer::Protect`: either we see the published pointer,
+        // or the reader sees the object already unlinked and doesn't use it.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::vector<const void*> hazards;
+        for (Record* record = records_.load(std::memory_order_acquire); record != nullptr;
+             record = record->next) {
+            if (const void* ptr = record->pointer.load(std::memory_order_acquire)) {
+                hazards.push_back(ptr);
+            }
+        }
+        std::sort(hazards.begin(), hazards.end());
+        return hazards;
+    }
+
+    // Null once the thread's list is gone.
+    static std::vector<Retired>* GetRetireList() {
+        RetireList* list = ThreadLocalCache<RetireList>::Get();
+        return list != nullptr ? &list->items : nullptr;
+    }
+    // Keeps reclamation amortised O(1) per object: at most half of a batch can be protected.
+    size_t ScanThreshold() const {
+        return std::max(kMinScanThreshold, 2 * record_count_.load(std::memory_order_relaxed));
+    }
+
+    static inline thread_local bool reclaiming_ = false;
+
+    std::atomic<Record*> records_ = nullptr;
+    std::atomic<size_t> record_count_ = 0;
+    std::mutex orphans_mutex_;
+    std::vector<Retired> orphans_;
+};
+
+// Owns one hazard record of the default domain for its lifetime.
+class HazardPointer {
+public:
+    HazardPointer() : record_(HazardDomain::Default().AcquireRecord()) {
+    }
+    HazardPointer(const HazardPointer&) = delete;
+    HazardPointer& operator=(const HazardPointer&) = delete;
+    ~HazardPointer() {
+        HazardDomain::Default().ReleaseRecord(record_);
+    }
+
+    // Load `src` and keep the result from being reclaimed until `Reset` or the next `Protect`.
+    // The object has to be reachable through `src` at the time of the call. Its last reference
+    // may still go away meanwhile: keep it longer with `TryOwn`, not `IntrusivePtr(ptr)`.
+    template <typename T>
+    T* Protect(const std::atomic<T*>& src) {
+        T* ptr = src.load(std::memory_order_relaxed);
+        while (true) {
+            record_->pointer.store(ptr, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            T* actual = src.load(std::memory_order_acquire);
+            if (actual == ptr) {
+                return ptr;
+            }
+            ptr = actual;
+        }
+    }
+    void Reset() {
+        record_->pointer.store(nullptr, std::memory_order_release);
+    }
+    // A reference to `ptr`, which this hazard pointer protects, or null if it has none left:
+    // then the object is retired, and a new reference would not stop the domain from
+    // reclaiming it. Needs a counter with `IncRefIfNotZero`, such as `AtomicCounter`.
+    template <typename T>
+    IntrusivePtr<T> TryOwn(T* ptr) const {
+        IntrusivePtr<T> result;
+        if (ptr != nullptr && ptr->IncRefIfNotZero()) {
+            result.object_ = ptr;
+        }
+        return result;
+    }
+    void Swap(HazardPointer& other) {
+        std::swap(record_, other.record_);
+    }
+
+private:
+    HazardDomain::Record* record_;
+};
+
+// `Deleter` policy for `RefCounted`: when the last reference drops, the object is retired to
+// the hazard pointer domain and destroyed with `D` once no reader protects it.
+// Since the object's destructor is deferred, so are the releases of the references it holds:
+// a protected node keeps every node it points to alive, which makes hand-over-hand traversal
+// safe with two hazard pointers.
+template <typename D = DefaultDelete>
+struct HazardDelete {
+    template <typename T>
+    static void Destroy(T* object) {
+        HazardDomain::Default().Retire(object, &Reclaim<T>);
+    }
+
+private:
+    template <typename T>
+    static void Reclaim(void* object) {
+        D::Destroy(static_cast<T*>(object));
+    }
+};
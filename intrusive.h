@@ -1,5 +1,11 @@
 #pragma once
 
+#include "deferred.h"
+#include "refcount_profiler.h"
+#include "relocatable.h"
+#include "teardown.h"
+
+#include <atomic>   // for std::atomic / std::atomic_thread_fence
 #include <cstddef>  // for std::nullptr_t
 #include <utility>  // for std::exchange / std::swap
 
@@ -21,6 +27,49 @@ private:
     size_t count_ = 0;
 };
 
+// Thread-safe counter. Increments are relaxed: a new reference is always made from an existing one.
+// Decrements are release, and the last one is followed by an acquire fence, so the destroying
+// thread sees every write made through the other references.
+class AtomicCounter {
+public:
+    AtomicCounter() = default;
+    // A copied object starts with no references of its own.
+    AtomicCounter(const AtomicCounter&) {
+    }
+    AtomicCounter& operator=(const AtomicCounter&) {
+        return *this;
+    }
+
+    size_t IncRef() {
+        return count_.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    // Returns false (and leaves the counter untouched) if it is already zero: the object is
+    // being destroyed or, with `HazardDelete`, waits to be reclaimed, and must not be revived.
+    bool IncRefIfNotZero() {
+        size_t count = count_.load(std::memory_order_relaxed);
+        while (count != 0) {
+            if (count_.compare_exchange_weak(count, count + 1, std::memory_order_acq_rel,
+                                             std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    size_t DecRef() {
+        size_t count = count_.fetch_sub(1, std::memory_order_release) - 1;
+        if (count == 0) {
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        return count;
+    }
+    size_t RefCount() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<size_t> count_ = 0;
+};
+
 struct DefaultDelete {
     template <typename T>
     static void Destroy(T* object) {
@@ -28,16 +77,58 @@ struct DefaultDelete {
     }
 };
 
+// Destroys with `D`, but not on the spot: the object waits in `DeferredQueue` for
+// `DrainDeferred()` or the reclaimer thread.
+template <typename D = DefaultDelete>
+struct DeferredDelete {
+    template <typename T>
+    static void Destroy(T* object) {
+        DeferredQueue::Default().Push(object, &DestroyNow<T>);
+    }
+
+private:
+    template <typename T>
+    static void DestroyNow(void* object) {
+        D::Destroy(static_cast<T*>(object));
+    }
+};
+
+// Destroys with `D` through `FlatTeardown`: a list or tree of objects holding `IntrusivePtr`s
+// to each other is torn down iteratively, however long it is.
+template <typename D = DefaultDelete>
+struct FlatDelete {
+    template <typename T>
+    static void Destroy(T* object) {
+        FlatTeardown::Destroy(object, &DestroyNow<T>);
+    }
+
+private:
+    template <typename T>
+    static void DestroyNow(void* object) {
+        D::Destroy(static_cast<T*>(object));
+    }
+};
+
 template <typename Derived, typename Counter, typename Deleter>
 class RefCounted {
 public:
+    using DeleterType = Deleter;
+
     // Increase reference counter.
     void IncRef() {
+        ProfileRefcount(this);
         counter_.IncRef();
     }
+    // Increase reference counter unless no reference is left. Only for counters that can
+    // do it atomically, such as `AtomicCounter`.
+    bool IncRefIfNotZero() requires requires(Counter& counter) { counter.IncRefIfNotZero(); } {
+        ProfileRefcount(this);
+        return counter_.IncRefIfNotZero();
+    }
     // Decrease reference counter.
     // Destroy object using Deleter when the last instance dies.
     void DecRef() {
+        ProfileRefcount(this);
         size_t ref_cnt = counter_.DecRef();
         if (ref_cnt == 0) {
             Deleter::Destroy(static_cast<Derived*>(this));
@@ -58,10 +149,19 @@ private:
 template <typename Derived, typename D = DefaultDelete>
 using SimpleRefCounted = RefCounted<Derived, SimpleCounter, D>;
 
+template <typename Derived, typename D = DefaultDelete>
+using ThreadSafeRefCounted = RefCounted<Derived, AtomicCounter, D>;
+
+template <typename T>
+class IntrusiveWeakPtr;
+
 template <typename T>
 class IntrusivePtr {
     template <typename Y>
     friend class IntrusivePtr;
+    template <typename Y>
+    friend class IntrusiveWeakPtr;
+    friend class HazardPointer;
 
 public:
     // Constructors
@@ -69,6 +169,9 @@ public:
     }
     IntrusivePtr(std::nullptr_t) : object_(nullptr) {
     }
+    // Takes a new reference, so the object must have one already or be new. Not for pointers
+    // from `HazardPointer::Protect`, whose objects may have none left: see
+    // `HazardPointer::TryOwn`.
     IntrusivePtr(T* ptr) : object_(ptr) {
         object_->IncRef();
     }
@@ -81,7 +184,7 @@ public:
     }
 
     template <typename Y>
-    IntrusivePtr(IntrusivePtr<Y>&& other) : object_(other.object_) {
+    IntrusivePtr(IntrusivePtr<Y>&& other) noexcept : object_(other.object_) {
         other.object_ = nullptr;
     }
 
@@ -90,7 +193,7 @@ public:
             object_->IncRef();
         }
     }
-    IntrusivePtr(IntrusivePtr&& other) : object_(other.object_) {
+    IntrusivePtr(IntrusivePtr&& other) noexcept : object_(other.object_) {
         other.object_ = nullptr;
     }
 
@@ -108,7 +211,7 @@ public:
         }
         return *this;
     }
-    IntrusivePtr& operator=(IntrusivePtr&& other) {
+    IntrusivePtr& operator=(IntrusivePtr&& other) noexcept {
         if (object_ == other.object_) {
             return *this;
         }
@@ -140,7 +243,7 @@ public:
             object_->IncRef();
         }
     }
-    void Swap(IntrusivePtr& other) {
+    void Swap(IntrusivePtr& other) noexcept {
         std::swap(object_, other.object_);
     }
 
@@ -168,7 +271,18 @@ private:
     T* object_;
 };
 
+template <typename T>
+struct IsTriviallyRelocatable<IntrusivePtr<T>> : std::true_type {};
+
+// The object is created by the deleter policy of `T` if the policy knows how to
+// (e.g. `PoolDelete` reuses pooled memory), with `new` otherwise.
 template <typename T, typename... Args>
 IntrusivePtr<T> MakeIntrusive(Args&&... args) {
-    return IntrusivePtr<T>(new T(std::forward<Args>(args)...));
+    if constexpr (requires(Args&&... a) {
+                      T::DeleterType::template Create<T>(std::forward<Args>(a)...);
+                  }) {
+        return IntrusivePtr<T>(T::DeleterType::template Create<T>(std::forward<Args>(args)...));
+    } else {
+        return IntrusivePtr<T>(new T(std::forward<Args>(args)...));
+    }
 }
@@ -0,0 +1,259 @@
+#pragma once
+
+#include "intrusive.h"
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Counter policy for `RefCounted` that makes objects observable by `IntrusiveWeakPtr`.
+// Use it through `WeakRefCounted<Derived>`.
+struct WeakCounter;
+
+// Counters of a weakly observable intrusive object. `MakeIntrusive` allocates the block and
+// the object together, the block right before the object, so they still take one allocation.
+// Like `BlockObject`, the object is destroyed when the last strong reference goes away,
+// and the memory is freed when the last weak one does. `weak_` holds one extra reference
+// on behalf of all strong owners together.
+class IntrusiveWeakBlock {
+public:
+    enum class DestroyAction { kObject, kMemory };
+    using DestroyHook = void (*)(IntrusiveWeakBlock*, DestroyAction);
+
+    template <typename T, typename... Args>
+    static T* Create(Args&&... args) {
+        void* memory = ::operator new(GetSize<T>(), std::align_val_t(GetAlignment<T>()));
+        auto* object = reinterpret_cast<T*>(static_cast<unsigned char*>(memory) + GetOffset<T>());
+        auto* block = new (Of(object)) IntrusiveWeakBlock(&Destroy<T>);
+        try {
+            ::new (object) T(std::forward<Args>(args)...);
+        } catch (...) {
+            block->~IntrusiveWeakBlock();
+            ::operator delete(memory, GetSize<T>(), std::align_val_t(GetAlignment<T>()));
+            throw;
+        }
+        return object;
+    }
+    // The block of the object starting at `object`.
+    static IntrusiveWeakBlock* Of(const void* object) {
+        return reinterpret_cast<IntrusiveWeakBlock*>(
+            const_cast<unsigned char*>(static_cast<const unsigned char*>(object)) -
+            sizeof(IntrusiveWeakBlock));
+    }
+
+    void IncStrong() {
+        strong_.fetch_add(1, std::memory_order_relaxed);
+    }
+    // Returns false (and leaves the counter untouched) if the object is already dead.
+    bool IncStrongIfNotZero() {
+        size_t count = strong_.load(std::memory_order_relaxed);
+        while (count != 0) {
+            if (strong_.compare_exchange_weak(count, count + 1, std::memory_order_acq_rel,
+                                              std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    // Returns the new count; the object is destroyed when it drops to zero.
+    size_t DecStrong() {
+        size_t count = strong_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+        if (count == 0) {
+            destroy_(this, DestroyAction::kObject);
+            DecWeak();
+        }
+        return count;
+    }
+    void IncWeak() {
+        weak_.fetch_add(1, std::memory_order_relaxed);
+    }
+    void DecWeak() {
+        if (weak_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            destroy_(this, DestroyAction::kMemory);
+        }
+    }
+    size_t GetStrong() const {
+        return strong_.load(std::memory_order_relaxed);
+    }
+
+private:
+    explicit IntrusiveWeakBlock(DestroyHook destroy) : destroy_(destroy) {
+    }
+
+    template <typename T>
+    static constexpr size_t GetAlignment() {
+        return alignof(T) > alignof(IntrusiveWeakBlock) ? alignof(T) : alignof(IntrusiveWeakBlock);
+    }
+    // Where the object starts: the first suitably aligned address after the block.
+    template <typename T>
+    static constexpr size_t GetOffset() {
+        return (sizeof(IntrusiveWeakBlock) + alignof(T) - 1) / alignof(T) * alignof(T);
+    }
+    template <typename T>
+    static constexpr size_t GetSize() {
+        return GetOffset<T>() + sizeof(T);
+    }
+    template <typename T>
+    static void Destroy(IntrusiveWeakBlock* block, DestroyAction action) {
+        auto* object = reinterpret_cast<T*>(reinterpret_cast<unsigned char*>(block) +
+                                            sizeof(IntrusiveWeakBlock));
+        if (action == DestroyAction::kObject) {
+            object->~T();
+        } else {
+            block->~IntrusiveWeakBlock();
+            void* memory = reinterpret_cast<unsigned char*>(object) - GetOffset<T>();
+            ::operator delete(memory, GetSize<T>(), std::align_val_t(GetAlignment<T>()));
+        }
+    }
+
+    std::atomic<size_t> strong_ = 0;
+    std::atomic<size_t> weak_ = 1;
+    DestroyHook destroy_;
+};
+
+// Counters live in the `IntrusiveWeakBlock` in front of the object, which therefore has to be
+// created by `MakeIntrusive` (plain `new` is disabled). The object is found from a base class
+// through `dynamic_cast<void*>`, so objects of derived classes work too.
+template <typename Derived, typename Deleter>
+class RefCounted<Derived, WeakCounter, Deleter> {
+    static_assert(std::is_same_v<Deleter, DefaultDelete>,
+                  "objects with weak references are freed by their block");
+
+public:
+    using DeleterType = IntrusiveWeakBlock;
+
+    static void* operator new(size_t) = delete;
+    static void* operator new[](size_t) = delete;
+
+    // Increase reference counter.
+    void IncRef() {
+        IntrusiveWeakBlock* block = GetBlock();
+        ProfileRefcount(block);
+        block->IncStrong();
+    }
+    // Decrease reference counter.
+    // Destroy object when the last instance dies, free the memory when the last weak one does.
+    void DecRef() {
+        IntrusiveWeakBlock* block = GetBlock();
+        ProfileRefcount(block);
+        block->DecStrong();
+    }
+    // Get current counter value (the number of strong references).
+    size_t RefCount() const {
+        return GetBlock()->GetStrong();
+    }
+    RefCounted& operator=(const RefCounted& other) {
+        return *this;
+    }
+
+    IntrusiveWeakBlock* GetBlock() const {
+        const auto* object = static_cast<const Derived*>(this);
+        if constexpr (std::is_polymorphic_v<Derived>) {
+            return IntrusiveWeakBlock::Of(dynamic_cast<const void*>(object));
+        } else {
+            return IntrusiveWeakBlock::Of(object);
+        }
+    }
+};
+
+template <typename Derived>
+using WeakRefCounted = RefCounted<Derived, WeakCounter, DefaultDelete>;
+
+// Observes an object of a `WeakRefCounted` type without keeping it alive.
+// Keeps the block, so it can tell whether the object is still there after it is gone.
+template <typename T>
+class IntrusiveWeakPtr {
+    template <typename Y>
+    friend class IntrusiveWeakPtr;
+
+public:
+    // Constructors
+    IntrusiveWeakPtr() : object_(nullptr), block_(nullptr) {
+    }
+    IntrusiveWeakPtr(std::nullptr_t) : object_(nullptr), block_(nullptr) {
+    }
+    // `ptr` must be alive.
+    IntrusiveWeakPtr(T* ptr) : object_(ptr), block_(ptr != nullptr ? ptr->GetBlock() : nullptr) {
+        if (block_ != nullptr) {
+            block_->IncWeak();
+        }
+    }
+    template <typename Y>
+    IntrusiveWeakPtr(const IntrusivePtr<Y>& other) : IntrusiveWeakPtr(other.Get()) {
+    }
+
+    IntrusiveWeakPtr(const IntrusiveWeakPtr& other) : object_(other.object_), block_(other.block_) {
+        if (block_ != nullptr) {
+            block_->IncWeak();
+        }
+    }
+    template <typename Y>
+    IntrusiveWeakPtr(const IntrusiveWeakPtr<Y>& other)
+        : object_(other.object_), block_(other.block_) {
+        if (block_ != nullptr) {
+            block_->IncWeak();
+        }
+    }
+    IntrusiveWeakPtr(IntrusiveWeakPtr&& other) noexcept
+        : object_(std::exchange(other.object_, nullptr)),
+          block_(std::exchange(other.block_, nullptr)) {
+    }
+
+    // `operator=`-s
+    IntrusiveWeakPtr& operator=(const IntrusiveWeakPtr& other) {
+        IntrusiveWeakPtr(other).Swap(*this);
+        return *this;
+    }
+    IntrusiveWeakPtr& operator=(IntrusiveWeakPtr&& other) noexcept {
+        IntrusiveWeakPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    // Destructor
+    ~IntrusiveWeakPtr() {
+        if (block_ != nullptr) {
+            block_->DecWeak();
+        }
+    }
+
+    // Modifiers
+    void Reset() {
+        IntrusiveWeakPtr().Swap(*this);
+    }
+    void Swap(IntrusiveWeakPtr& other) noexcept {
+        std::swap(object_, other.object_);
+        std::swap(block_, other.block_);
+    }
+
+    // Observers
+    size_t UseCount() const {
+        if (block_ != nullptr) {
+            return block_->GetStrong();
+        }
+        return 0;
+    }
+    bool Expired() const {
+        return UseCount() == 0;
+    }
+    // A strong reference to the object, or null if it is already dead.
+    IntrusivePtr<T> Lock() const {
+        IntrusivePtr<T> result;
+        if (block_ == nullptr) {
+            return result;
+        }
+        ProfileRefcount(block_);
+        if (block_->IncStrongIfNotZero()) {
+            result.object_ = object_;
+        }
+        return result;
+    }
+
+private:
+    T* object_;
+    IntrusiveWeakBlock* block_;
+};
+
+template <typename T>
+struct IsTriviallyRelocatable<IntrusiveWeakPtr<T>> : std::true_type {};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "intrusive.h"
+#include "thread_local_cache.h"
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+// Per-type, per-thread free list of memory for `T` objects.
+// Memory is obtained and released exactly like `new T`/`delete` do, so pooled memory and
+// memory of plain `new` are interchangeable. A freed chunk joins the list of the freeing
+// thread; past `kMaxCached` chunks, or when the thread exits, it goes back to the heap.
+template <typename T>
+class ObjectPool {
+    static_assert(sizeof(T) >= sizeof(void*));
+
+public:
+    static constexpr size_t kMaxCached = 256;
+
+    static void* Allocate() {
+        Cache* cache = GetCache();
+        if (cache != nullptr && cache->head != nullptr) {
+            Node* node = cache->head;
+            cache->head = node->next;
+            --cache->count;
+            return node;
+        }
+        return AllocateRaw();
+    }
+    static void Free(void* ptr) {
+        Cache* cache = GetCache();
+        if (cache == nullptr || cache->count == kMaxCached) {
+            FreeRaw(ptr);
+            return;
+        }
+        auto* node = static_cast<Node*>(ptr);
+        node->next = cache->head;
+        cache->head = node;
+        ++cache->count;
+    }
+
+private:
+    struct Node {
+        Node* next;
+    };
+    struct Cache {
+        ~Cache() {
+            while (head != nullptr) {
+                FreeRaw(std::exchange(head, head->next));
+            }
+        }
+        Node* head = nullptr;
+        size_t count = 0;
+    };
+
+    static constexpr bool kOverAligned = alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+    static void* AllocateRaw() {
+        if constexpr (kOverAligned) {
+            return ::operator new(sizeof(T), std::align_val_t(alignof(T)));
+        } else {
+            return ::operator new(sizeof(T));
+        }
+    }
+    static void FreeRaw(void* ptr) {
+        if constexpr (kOverAligned) {
+            ::operator delete(ptr, sizeof(T), std::align_val_t(alignof(T)));
+        } else {
+            ::operator delete(ptr, sizeof(T));
+        }
+    }
+    static Cache* GetCache() {
+        return ThreadLocalCache<Cache>::Get();
+    }
+};
+
+// `Deleter` policy for `RefCounted` that recycles memory: the last reference destroys the object
+// and returns its memory to `ObjectPool<T>`, and `MakeIntrusive` constructs new objects in
+// pooled memory, so steady-state churn of a type doesn't reach malloc.
+// Objects of a class derived from `T` are deleted as usual: their memory has a different size.
+struct PoolDelete {
+    template <typename T, typename... Args>
+    static T* Create(Args&&... args) {
+        void* memory = ObjectPool<T>::Allocate();
+        try {
+            return new (memory) T(std::forward<Args>(args)...);
+        } catch (...) {
+            ObjectPool<T>::Free(memory);
+            throw;
+        }
+    }
+    template <typename T>
+    static void Destroy(T* object) {
+        if constexpr (std::is_polymorphic_v<T>) {
+            if (typeid(*object) != typeid(T)) {
+                delete object;
+                return;
+            }
+        }
+        object->~T();
+        ObjectPool<T>::Free(object);
+    }
+};
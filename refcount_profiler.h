@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>  // for std::hash
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#if defined(__unix__)
+#include <dlfcn.h>  // for dladdr
+#endif
+
+// Sampling profiler of reference count traffic.
+// Compiled in only when `SMART_PTRS_REFCOUNT_PROFILER` is defined: then every `SharedPtr`
+// strong count change, every `RefCounted::IncRef`/`DecRef` and every attempt to lock a weak
+// pointer counts down a thread-local counter, and each N-th one records the counter's address,
+// the calling thread and the address of the code that did it. Otherwise the hooks are empty.
+//
+// A block touched by many threads, with the samples hopping between them, is the one whose
+// cache line bounces between cores. Call sites are ranked by how many of their samples hit
+// such blocks. Call sites are printed as `module+offset`, ready for `addr2line -f -C -e module`.
+class RefcountProfiler {
+public:
+    struct BlockReport {
+        const void* counter;
+        size_t samples;
+        size_t threads;
+        // Samples taken on a different thread than the previous sample of the same counter.
+        size_t thread_switches;
+    };
+    struct CallSiteReport {
+        const void* call_site;
+        size_t samples;
+        // Samples that hit a counter touched by more than one thread.
+        size_t contended_samples;
+    };
+
+    static constexpr uint32_t kDefaultPeriod = 1024;
+    static constexpr size_t kMaxSamples = size_t(1) << 20;
+
+    static RefcountProfiler& Default() {
+        static RefcountProfiler* profiler = new RefcountProfiler();
+        return *profiler;
+    }
+
+    // Record every `period`-th operation of each thread; 0 stops sampling.
+    // Takes effect at the next operation of every thread: their countdowns restart.
+    void SetPeriod(uint32_t period) {
+        period_.store(period, std::memory_order_relaxed);
+        generation_.fetch_add(1, std::memory_order_release);
+    }
+
+    // Out of line, so that the return address is the code that touched the counter.
+    [[gnu::noinline]] void Sample(const void* counter) {
+        Restart();
+        if (countdown_ != kStopped) {
+            Record(counter, __builtin_return_address(0));
+        }
+    }
+    // Start the thread's countdown over with the current period.
+    [[gnu::noinline]] void Restart() {
+        seen_generation_ = generation_.load(std::memory_order_acquire);
+        uint32_t period = period_.load(std::memory_order_relaxed);
+        countdown_ = period == 0 ? kStopped : period;
+    }
+
+    void Record(const void* counter, const void* call_site) {
+        std::lock_guard lock(mutex_);
+        Entry entry{counter, call_site, std::hash<std::thread::id>()(std::this_thread::get_id())};
+        if (samples_.size() < kMaxSamples) {
+            samples_.push_back(entry);
+        } else {
+            samples_[next_++ % kMaxSamples] = entry;
+        }
+    }
+
+    void Clear() {
+        std::lock_guard lock(mutex_);
+        samples_.clear();
+        next_ = 0;
+    }
+
+    std::vector<BlockReport> TopBlocks(size_t count) const {
+        std::vector<BlockReport> result;
+        for (const auto& [counter, stats] : CollectBlocks()) {
+            result.push_back({counter, stats.samples, stats.threads.size(), stats.thread_switches});
+        }
+        std::sort(result.begin(), result.end(), [](const BlockReport& lhs, const BlockReport& rhs) {
+            if (lhs.thread_switches != rhs.thread_switches) {
+                return lhs.thread_switches > rhs.thread_switches;
+            }
+            return lhs.samples > rhs.samples;
+        });
+        result.resize(std::min(count, result.size()));
+        return result;
+    }
+
+    std::vector<CallSiteReport> TopCallSites(size_t count) const {
+        auto blocks = CollectBlocks();
+        std::unordered_map<const void*, CallSiteReport> sites;
+        for (const Entry& entry : Samples()) {
+            auto& site = sites.try_emplace(entry.call_site, CallSiteReport{entry.call_site, 0, 0})
+                             .first->second;
+            ++site.samples;
+            if (blocks[entry.counter].threads.size() > 1) {
+                ++site.contended_samples;
+            }
+        }
+        std::vector<CallSiteReport> result;
+        for (const auto& [call_site, report] : sites) {
+            result.push_back(report);
+        }
+        std::sort(result.begin(), result.end(),
+                  [](const CallSiteReport& lhs, const CallSiteReport& rhs) {
+                      if (lhs.contended_samples != rhs.contended_samples) {
+                          return lhs.contended_samples > rhs.contended_samples;
+                      }
+                      return lhs.samples > rhs.samples;
+                  });
+        result.resize(std::min(count, result.size()));
+        return result;
+    }
+
+    void Report(std::ostream& out, size_t count = 10) const {
+        out << "top contended counters:\n";
+        for (const BlockReport& block : TopBlocks(count)) {
+            out << "    " << block.counter << ": samples " << block.samples << ", threads "
+                << block.threads << ", thread switches " << block.thread_switches << '\n';
+        }
+        out << "top call sites:\n";
+        for (const CallSiteReport& site : TopCallSites(count)) {
+            out << "    " << FormatCallSite(site.call_site) << ": samples " << site.samples
+                << ", on contended " << site.contended_samples << '\n';
+        }
+    }
+
+    // Thread-local countdown to the next sample, and the `SetPeriod` call it was started after;
+    // read inline by the hook.
+    static inline thread_local uint32_t countdown_ = kDefaultPeriod;
+    static inline thread_local uint32_t seen_generation_ = 0;
+    static inline std::atomic<uint32_t> generation_ = 0;
+
+private:
+    // The countdown of a stopped profiler: it would take 2^32 operations to run out, and a
+    // `SetPeriod` restarts it before then.
+    static constexpr uint32_t kStopped = UINT32_MAX;
+
+    struct Entry {
+        const void* counter;
+        const void* call_site;
+        size_t thread;
+    };
+    struct RefcountSample {
+        size_t samples = 0;
+        std::unordered_set<size_t> threads;
+        size_t thread_switches = 0;
+        size_t last_thread = 0;
+    };
+
+    RefcountProfiler() = default;
+
+    static std::string FormatCallSite(const void* call_site) {
+        std::ostringstream out;
+#if defined(__unix__)
+        Dl_info info;
+        if (dladdr(call_site, &info) != 0 && info.dli_fname != nullptr) {
+            out << info.dli_fname << "+0x" << std::hex
+                << (reinterpret_cast<uintptr_t>(call_site) -
+                    reinterpret_cast<uintptr_t>(info.dli_fbase));
+            return out.str();
+        }
+#endif
+        out << call_site;
+        return out.str();
+    }
+
+    // Oldest first.
+    std::vector<Entry> Samples() const {
+        std::lock_guard lock(mutex_);
+        std::vector<Entry> result;
+        size_t start = samples_.size() < kMaxSamples ? 0 : next_ % kMaxSamples;
+        for (size_t i = 0; i < samples_.size(); ++i) {
+            result.push_back(samples_[(start + i) % samples_.size()]);
+        }
+        return result;
+    }
+    std::unordered_map<const void*, RefcountSample> CollectBlocks() const {
+        std::unordered_map<const void*, RefcountSample> blocks;
+        for (const Entry& entry : Samples()) {
+            RefcountSample& block = blocks[entry.counter];
+            if (block.samples != 0 && block.last_thread != entry.thread) {
+                ++block.thread_switches;
+            }
+            ++block.samples;
+            block.threads.insert(entry.thread);
+            block.last_thread = entry.thread;
+        }
+        return blocks;
+    }
+
+    std::atomic<uint32_t> period_ = kDefaultPeriod;
+    mutable std::mutex mutex_;
+    std::vector<Entry> samples_;
+    size_t next_ = 0;
+};
+
+// The hook called by reference counting code.
+inline void ProfileRefcount([[maybe_unused]] const void* counter) {
+#ifdef SMART_PTRS_REFCOUNT_PROFILER
+    if (RefcountProfiler::seen_generation_ !=
+        RefcountProfiler::generation_.load(std::memory_order_relaxed)) {
+        RefcountProfiler::Default().Restart();
+    }
+    if (--RefcountProfiler::countdown_ == 0) {
+        RefcountProfiler::Default().Sample(counter);
+    }
+#endif
+}
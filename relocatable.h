@@ -0,0 +1,195 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>  // std::memcpy
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Whether an object of `T` may be moved to another address by copying its bytes and
+// forgetting the original, without running the move constructor and the destructor.
+// True for trivially copyable types; smart pointers opt in by specializing it, since
+// none of them keeps its own address anywhere.
+template <class T>
+struct IsTriviallyRelocatable : std::is_trivially_copyable<T> {};
+
+// Move-only growable array, like `std::vector`, that relocates its elements with
+// `memcpy` when `IsTriviallyRelocatable<T>`. Growing a vector of `SharedPtr`s is then a bulk
+// copy of memory instead of a move constructor and a destructor call per element.
+// Other types are moved (or copied, if their move constructor may throw) as usual.
+template <class T>
+class RelocatingVector {
+public:
+    static constexpr bool kRelocatable = IsTriviallyRelocatable<T>::value;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    RelocatingVector() : data_(nullptr), size_(0), capacity_(0) {
+    }
+    RelocatingVector(const RelocatingVector&) = delete;
+    RelocatingVector(RelocatingVector&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr)),
+          size_(std::exchange(other.size_, 0)),
+          capacity_(std::exchange(other.capacity_, 0)) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    RelocatingVector& operator=(const RelocatingVector&) = delete;
+    RelocatingVector& operator=(RelocatingVector&& other) noexcept {
+        RelocatingVector(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~RelocatingVector() {
+        Clear();
+        Deallocate(data_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reserve(size_t capacity) {
+        if (capacity > capacity_) {
+            Reallocate(capacity);
+        }
+    }
+    template <class... Args>
+    T& EmplaceBack(Args&&... args) {
+        if (size_ < capacity_) {
+            new (data_ + size_) T(std::forward<Args>(args)...);
+            return data_[size_++];
+        }
+        // The new element is made before the old ones move: `args` may refer to one of them.
+        size_t capacity = capacity_ == 0 ? 1 : 2 * capacity_;
+        T* data = Allocate(capacity);
+        try {
+            new (data + size_) T(std::forward<Args>(args)...);
+        } catch (...) {
+            Deallocate(data);
+            throw;
+        }
+        try {
+            MoveTo(data);
+        } catch (...) {
+            data[size_].~T();
+            Deallocate(data);
+            throw;
+        }
+        Adopt(data, capacity);
+        return data_[size_++];
+    }
+    void PushBack(const T& value) {
+        EmplaceBack(value);
+    }
+    void PushBack(T&& value) {
+        EmplaceBack(std::move(value));
+    }
+    void PopBack() {
+        data_[--size_].~T();
+    }
+    void Clear() {
+        while (size_ != 0) {
+            PopBack();
+        }
+    }
+    void Swap(RelocatingVector& other) noexcept {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(capacity_, other.capacity_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T& operator[](size_t index) {
+        return data_[index];
+    }
+    const T& operator[](size_t index) const {
+        return data_[index];
+    }
+    T* Data() {
+        return data_;
+    }
+    const T* Data() const {
+        return data_;
+    }
+    size_t Size() const {
+        return size_;
+    }
+    size_t Capacity() const {
+        return capacity_;
+    }
+    bool Empty() const {
+        return size_ == 0;
+    }
+    T* begin() {
+        return data_;
+    }
+    T* end() {
+        return data_ + size_;
+    }
+    const T* begin() const {
+        return data_;
+    }
+    const T* end() const {
+        return data_ + size_;
+    }
+
+private:
+    static T* Allocate(size_t capacity) {
+        return static_cast<T*>(::operator new(capacity * sizeof(T), std::align_val_t(alignof(T))));
+    }
+    static void Deallocate(T* data) {
+        ::operator delete(data, std::align_val_t(alignof(T)));
+    }
+
+    void Reallocate(size_t capacity) {
+        T* data = Allocate(capacity);
+        try {
+            MoveTo(data);
+        } catch (...) {
+            Deallocate(data);
+            throw;
+        }
+        Adopt(data, capacity);
+    }
+    // Move the elements to `data`, leaving the old storage to be freed by `Adopt`.
+    // If a move throws, everything is left as it was.
+    void MoveTo(T* data) {
+        if constexpr (kRelocatable) {
+            if (size_ != 0) {
+                std::memcpy(static_cast<void*>(data), static_cast<const void*>(data_),
+                            size_ * sizeof(T));
+            }
+        } else {
+            size_t moved = 0;
+            try {
+                for (; moved < size_; ++moved) {
+                    new (data + moved) T(std::move_if_noexcept(data_[moved]));
+                }
+            } catch (...) {
+                while (moved != 0) {
+                    data[--moved].~T();
+                }
+                throw;
+            }
+            for (size_t i = 0; i < size_; ++i) {
+                data_[i].~T();
+            }
+        }
+    }
+    void Adopt(T* data, size_t capacity) {
+        Deallocate(std::exchange(data_, data));
+        capacity_ = capacity;
+    }
+
+    T* data_;
+    size_t size_;
+    size_t capacity_;
+};
@@ -1,18 +1,33 @@
 #pragma once
 
+#include "relocatable.h"
 #include "sw_fwd.h"  // Forward declaration
+#include "unique.h"  // Slug, UniquePtr
 
 #include <cstddef>  // std::nullptr_t
+#include <memory>   // std::allocator, std::allocator_traits
 
 // https://en.cppreference.com/w/cpp/memory/shared_ptr
+// `T` may be an array, `T[]` or `T[N]`: then the pointer refers to its first element,
+// is indexed with `operator[]` and, when owning a raw pointer, frees it with `delete[]`.
 template <typename T>
 class SharedPtr {
     template <typename Y>
     friend class SharedPtr;
     template <typename Y>
     friend class WeakPtr;
+    template <typename Y>
+    friend class AtomicSharedPtr;
+    template <typename Y>
+    friend class ThinSharedPtr;
+    template <typename Y>
+    friend class SharedRef;
+    template <typename Y, typename Mode>
+    friend class EnableSharedFromThis;
 
 public:
+    using ElementType = std::remove_extent_t<T>;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
@@ -21,38 +36,75 @@ public:
     SharedPtr(std::nullptr_t) : block_(nullptr), observer_(nullptr) {
     }
     template <class Y>
-    explicit SharedPtr(Y* ptr) : block_(new BlockPointer<Y>(ptr)), observer_(ptr) {
+    requires IsOwnablePointer<Y, T>::value explicit SharedPtr(Y* ptr)
+        : SharedPtr(ptr, std::conditional_t<std::is_array_v<T>, Slug<Y[]>, Slug<Y>>()) {
+    }
+    template <class Y, class Deleter>
+    requires IsOwnablePointer<Y, T>::value SharedPtr(Y* ptr, Deleter deleter)
+        : SharedPtr(ptr, std::move(deleter), DefaultBlockAllocator<Y>()) {
+    }
+    template <class Y, class Deleter, class Alloc>
+    requires IsOwnablePointer<Y, T>::value SharedPtr(Y* ptr, Deleter deleter, const Alloc& alloc)
+        : block_(BlockPointer<Y, Deleter, Alloc>::Create(ptr, std::move(deleter), alloc)),
+          observer_(ptr) {
         if constexpr (std::is_convertible_v<T*, EnableSharedFromThisBase*>) {
             InitWeakThis(ptr);
         }
     }
+    // Takes over both the object and the deleter of `other`
+    template <class Y, class Deleter>
+    requires IsCompatiblePointer<Y, T>::value SharedPtr(UniquePtr<Y, Deleter>&& other)
+        : block_(nullptr), observer_(other.Get()) {
+        if (observer_ != nullptr) {
+            using Object = std::remove_extent_t<Y>;
+            using ObjectAlloc = DefaultBlockAllocator<Object>;
+            // Like `std::shared_ptr`: if the block can't be made, `other` keeps the object.
+            block_ = BlockPointer<Object, Deleter, ObjectAlloc>::Adopt(other, ObjectAlloc());
+            if constexpr (std::is_convertible_v<T*, EnableSharedFromThisBase*>) {
+                InitWeakThis(observer_);
+            }
+        }
+    }
 
     SharedPtr(const SharedPtr& other) : block_(other.block_), observer_(other.observer_) {
         if (block_ != nullptr) {
             block_->IncStrongCounter();
         }
     }
+    SharedPtr(SharedPtr&& other) noexcept
+        : block_(std::exchange(other.block_, nullptr)),
+          observer_(std::exchange(other.observer_, nullptr)) {
+    }
 
     template <class Y>
-    SharedPtr(const SharedPtr<Y>& other) : block_(other.block_), observer_(other.observer_) {
+    requires IsCompatiblePointer<Y, T>::value SharedPtr(const SharedPtr<Y>& other)
+        : block_(other.block_), observer_(other.observer_) {
         if (block_ != nullptr) {
             block_->IncStrongCounter();
         }
     }
     template <class Y>
-    SharedPtr(SharedPtr<Y>&& other) : block_(other.block_), observer_(other.observer_) {
+    requires IsCompatiblePointer<Y, T>::value SharedPtr(SharedPtr<Y>&& other) noexcept
+        : block_(other.block_), observer_(other.observer_) {
         other.block_ = nullptr;
         other.observer_ = nullptr;
     }
-    explicit SharedPtr(BlockObject<T>* ptr) : block_(ptr), observer_(ptr->GetObserver()) {
+    template <class Alloc, class Base, class Layout>
+    explicit SharedPtr(BlockObject<T, Alloc, Base, Layout>* ptr)
+        : block_(ptr), observer_(ptr->GetObserver()) {
         if constexpr (std::is_base_of_v<EnableSharedFromThisBase, T>) {
             InitWeakThis(ptr->GetObserver());
         }
     }
+    template <class Alloc>
+    requires std::is_array_v<T> explicit SharedPtr(BlockArray<ElementType, Alloc>* ptr)
+        : block_(ptr), observer_(ptr->GetObserver()) {
+    }
     // Aliasing constructor
     // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
+    // Like there, `Y` is not constrained: `ptr` says what the result points to.
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other, T* ptr) : block_(other.block_), observer_(ptr) {
+    SharedPtr(const SharedPtr<Y>& other, ElementType* ptr) : block_(other.block_), observer_(ptr) {
         if (block_ != nullptr) {
             block_->IncStrongCounter();
         }
@@ -60,15 +112,10 @@ public:
 
     // Promote `WeakPtr`
     // #11 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
-    explicit SharedPtr(const WeakPtr<T>& other) {
-        if (other.Expired()) {
+    explicit SharedPtr(const WeakPtr<T>& other) : block_(other.block_), observer_(other.observer_) {
+        if (block_ == nullptr || !block_->IncStrongCounterIfNotZero()) {
             throw BadWeakPtr();
         }
-        block_ = other.block_;
-        observer_ = other.observer_;
-        if (block_ != nullptr) {
-            block_->IncStrongCounter();
-        }
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -85,14 +132,8 @@ public:
         }
         return *this;
     }
-    SharedPtr& operator=(SharedPtr&& other) {
-        if (block_ != nullptr) {
-            block_->DecStrongCounter();
-        }
-        block_ = other.block_;
-        observer_ = other.observer_;
-        other.block_ = nullptr;
-        other.observer_ = nullptr;
+    SharedPtr& operator=(SharedPtr&& other) noexcept {
+        SharedPtr(std::move(other)).Swap(*this);
         return *this;
     }
 
@@ -117,27 +158,43 @@ public:
     }
     template <class Y>
     void Reset(Y* ptr) {
-        Reset();
-        block_ = new BlockPointer<Y>(ptr);
-        observer_ = ptr;
+        SharedPtr(ptr).Swap(*this);
+    }
+    template <class Y, class Deleter>
+    void Reset(Y* ptr, Deleter deleter) {
+        SharedPtr(ptr, std::move(deleter)).Swap(*this);
+    }
+    template <class Y, class Deleter, class Alloc>
+    void Reset(Y* ptr, Deleter deleter, const Alloc& alloc) {
+        SharedPtr(ptr, std::move(deleter), alloc).Swap(*this);
     }
-    void Swap(SharedPtr& other) {
+    void Swap(SharedPtr& other) noexcept {
         std::swap(block_, other.block_);
         std::swap(observer_, other.observer_);
     }
+    // When the last owner goes away, leave the object to `DrainDeferred()` or the
+    // `DeferredQueue` reclaimer thread instead of destroying it on the spot.
+    void DeferDestruction() const {
+        if (block_ != nullptr) {
+            block_->DeferDestruction();
+        }
+    }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Observers
 
-    T* Get() const {
+    ElementType* Get() const {
         return observer_;
     }
-    T& operator*() const {
+    T& operator*() const requires(!std::is_array_v<T>) {
         return *observer_;
     }
-    T* operator->() const {
+    T* operator->() const requires(!std::is_array_v<T>) {
         return observer_;
     }
+    ElementType& operator[](std::ptrdiff_t index) const requires std::is_array_v<T> {
+        return observer_[index];
+    }
     size_t UseCount() const {
         if (block_ != nullptr) {
             return block_->GetStrongCounter();
@@ -148,29 +205,114 @@ public:
         return block_ != nullptr;
     }
     template <typename Y>
-    void InitWeakThis(EnableSharedFromThis<Y>* e) {
+    void InitWeakThis(EnableSharedFromThis<Y, StoreWeakThis>* e) {
         e->weak_this_ = *this;
     }
+    template <typename Y>
+    void InitWeakThis(EnableSharedFromThis<Y, LocateBlock>* e) {
+        if (e->FindBlock() == block_) {
+            return;
+        }
+        try {
+            SharedFromThisRegistry::Add(e, block_);
+        } catch (...) {
+            block_->DecStrongCounter();
+            throw;
+        }
+    }
 
 private:
     BaseBlock* block_;
-    T* observer_;
+    ElementType* observer_;
 };
 
+template <typename T>
+struct IsTriviallyRelocatable<SharedPtr<T>> : std::true_type {};
+
 template <typename T, typename U>
 inline bool operator==(const SharedPtr<T>& left, const SharedPtr<U>& right) {
     return left.Get() == right.Get();
 }
 
+// Allocate memory only once, using `alloc` (rebound to the control block type)
+// https://en.cppreference.com/w/cpp/memory/shared_ptr/allocate_shared
+template <typename T, typename Alloc, typename... Args>
+requires(!std::is_array_v<T>) SharedPtr<T> AllocateShared(const Alloc& alloc, Args&&... args) {
+    using ObjectAlloc =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<std::remove_cv_t<T>>;
+    return SharedPtr<T>(
+        BlockObject<T, ObjectAlloc>::Create(ObjectAlloc(alloc), std::forward<Args>(args)...));
+}
+
+template <typename T, typename Alloc, typename... Init>
+SharedPtr<T> AllocateSharedArray(const Alloc& alloc, size_t n, const Init&... init) {
+    using Element = std::remove_extent_t<T>;
+    using ElementAlloc =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<std::remove_cv_t<Element>>;
+    return SharedPtr<T>(BlockArray<Element, ElementAlloc>::Create(ElementAlloc(alloc), n, init...));
+}
+
+// Arrays: the counters and all `n` elements in one allocation, the elements value-initialised
+// or copies of `init`. `T[N]` takes no `n`.
+template <typename T, typename Alloc>
+requires std::is_unbounded_array_v<T> SharedPtr<T> AllocateShared(const Alloc& alloc, size_t n) {
+    return AllocateSharedArray<T>(alloc, n);
+}
+template <typename T, typename Alloc>
+requires std::is_unbounded_array_v<T> SharedPtr<T> AllocateShared(
+    const Alloc& alloc, size_t n, const std::remove_extent_t<T>& init) {
+    return AllocateSharedArray<T>(alloc, n, init);
+}
+template <typename T, typename Alloc>
+requires std::is_bounded_array_v<T> SharedPtr<T> AllocateShared(const Alloc& alloc) {
+    return AllocateSharedArray<T>(alloc, std::extent_v<T>);
+}
+template <typename T, typename Alloc>
+requires std::is_bounded_array_v<T> SharedPtr<T> AllocateShared(
+    const Alloc& alloc, const std::remove_extent_t<T>& init) {
+    return AllocateSharedArray<T>(alloc, std::extent_v<T>, init);
+}
+
 // Allocate memory only once
 template <typename T, typename... Args>
-SharedPtr<T> MakeShared(Args&&... args) {
-    return SharedPtr<T>(new BlockObject<T>(std::forward<Args>(args)...));
+requires(!std::is_array_v<T>) SharedPtr<T> MakeShared(Args&&... args) {
+    return AllocateShared<T>(DefaultBlockAllocator<T>(), std::forward<Args>(args)...);
+}
+template <typename T>
+requires std::is_unbounded_array_v<T> SharedPtr<T> MakeShared(size_t n) {
+    return AllocateShared<T>(DefaultBlockAllocator<std::remove_extent_t<T>>(), n);
+}
+template <typename T>
+requires std::is_unbounded_array_v<T> SharedPtr<T> MakeShared(size_t n,
+                                                              const std::remove_extent_t<T>& init) {
+    return AllocateShared<T>(DefaultBlockAllocator<std::remove_extent_t<T>>(), n, init);
+}
+template <typename T>
+requires std::is_bounded_array_v<T> SharedPtr<T> MakeShared() {
+    return AllocateShared<T>(DefaultBlockAllocator<std::remove_extent_t<T>>());
+}
+template <typename T>
+requires std::is_bounded_array_v<T> SharedPtr<T> MakeShared(const std::remove_extent_t<T>& init) {
+    return AllocateShared<T>(DefaultBlockAllocator<std::remove_extent_t<T>>(), init);
+}
+
+// Same as `MakeShared`, but the block uses biased reference counting (see `BiasedBlockBase`):
+// copies made and dropped on the calling thread don't need atomic operations.
+// A thread that has already exited (running its thread-local destructors) has no owner to
+// bias towards and gets a plain block.
+template <typename T, typename... Args>
+SharedPtr<T> MakeSharedBiased(Args&&... args) {
+    if (BiasedOwner::Current() == nullptr) {
+        return MakeShared<T>(std::forward<Args>(args)...);
+    }
+    using ObjectAlloc = DefaultBlockAllocator<T>;
+    return SharedPtr<T>(BlockObject<T, ObjectAlloc, BiasedBlockBase>::Create(
+        ObjectAlloc(), std::forward<Args>(args)...));
 }
 
 // Look for usage examples in tests
 
-template <typename T>
+template <typename T, typename Mode>
 class EnableSharedFromThis : public EnableSharedFromThisBase {
     template <typename Y>
     friend class SharedPtr;
@@ -195,3 +337,79 @@ public:
 private:
     WeakPtr<T> weak_this_;
 };
+
+// Same interface without any data in the object: `MakeShared` puts the object at a fixed
+// offset after its block (given by the alignment of `T` and its `BlockLayoutOf`), so the block
+// is found from `this` by subtraction, like `IntrusiveWeakBlock` does. Saves the 16 bytes of
+// `weak_this_` and the weak increment and decrement that setting it costs. Objects whose block
+// is elsewhere (owned through a raw pointer or a `UniquePtr`, made by `MakeSharedBiased` or
+// with a stateful allocator) still work: their owner records the block in
+// `SharedFromThisRegistry`, at the price of a locked lookup in `SharedFromThis()` while any
+// such object is alive. So do objects of a polymorphic `T` whose most derived class is more
+// aligned than `T` or has another layout: the offset is computed for `T`, the dynamic type's
+// alignment isn't known.
+//
+// The object must be owned by a `SharedPtr`, and the calls can't be made from constructors
+// and destructors: the address of the whole object isn't known there.
+template <typename T>
+class EnableSharedFromThis<T, LocateBlock> : public LocatedSharedFromThisBase {
+    template <typename Y>
+    friend class SharedPtr;
+
+public:
+    SharedPtr<T> SharedFromThis() {
+        return Share<T>();
+    }
+    SharedPtr<const T> SharedFromThis() const {
+        return const_cast<EnableSharedFromThis*>(this)->template Share<const T>();
+    }
+
+    WeakPtr<T> WeakFromThis() {
+        return Watch<T>();
+    }
+    WeakPtr<const T> WeakFromThis() const {
+        return const_cast<EnableSharedFromThis*>(this)->template Watch<const T>();
+    }
+
+private:
+    template <typename Y>
+    SharedPtr<Y> Share() {
+        BaseBlock* block = GetBlock();
+        if (!block->IncStrongCounterIfNotZero()) {
+            throw BadWeakPtr();
+        }
+        SharedPtr<Y> result;
+        result.block_ = block;
+        result.observer_ = static_cast<T*>(this);
+        return result;
+    }
+    template <typename Y>
+    WeakPtr<Y> Watch() {
+        BaseBlock* block = GetBlock();
+        block->IncWeakCounter();
+        WeakPtr<Y> result;
+        result.block_ = block;
+        result.observer_ = static_cast<T*>(this);
+        return result;
+    }
+    BaseBlock* GetBlock() const {
+        if (BaseBlock* block = SharedFromThisRegistry::Find(this)) {
+            return block;
+        }
+        return FindBlock();
+    }
+    // Where the block is if the object was made by `MakeShared` (see `BlockObject`).
+    BaseBlock* FindBlock() const {
+        using Layout = typename BlockLayoutOf<std::remove_cv_t<T>>::Type;
+        constexpr size_t kAlignment = std::max(Layout::kObjectAlignment, alignof(T));
+        constexpr size_t kCountersEnd = Layout::kLeadingPadding + sizeof(BaseBlock);
+        constexpr size_t kOffset =
+            (kCountersEnd + kAlignment - 1) / kAlignment * kAlignment - Layout::kLeadingPadding;
+        const void* object = static_cast<const T*>(this);
+        if constexpr (std::is_polymorphic_v<T>) {
+            object = dynamic_cast<const void*>(static_cast<const T*>(this));
+        }
+        return reinterpret_cast<BaseBlock*>(
+            const_cast<unsigned char*>(static_cast<const unsigned char*>(object)) - kOffset);
+    }
+};
@@ -1,6 +1,27 @@
 #pragma once
 
+#include "block_pool.h"
+#include "block_stats.h"
+#include "compressed_pair.h"
+#include "deferred.h"
+#include "refcount_profiler.h"
+#include "teardown.h"
+#include "thread_local_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <exception>
+#include <limits>
+#include <stdexcept>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 class BadWeakPtr : public std::exception {};
 
@@ -10,105 +31,955 @@ class SharedPtr;
 template <typename T>
 class WeakPtr;
 
-class EnableSharedFromThisBase {};
 template <typename T>
+class AtomicSharedPtr;
+
+template <typename T>
+class ThinSharedPtr;
+
+template <typename T>
+class ThinWeakPtr;
+
+template <typename T>
+class SharedRef;
+
+// Whether a `SharedPtr<Y>` (`WeakPtr<Y>`, `SharedRef<Y>`) converts to a `SharedPtr<T>`, as for
+// `std::shared_ptr`: `Y*` must convert to `T*`, or `Y` be `U[N]` and `T` be `cv U[]`. So arrays
+// never convert to or from non-arrays, and `Derived[]` never converts to `Base[]`: indexing
+// would step by the size of the wrong type.
+template <typename Y, typename T>
+struct IsCompatiblePointer
+    : std::bool_constant<std::is_convertible_v<Y*, T*> ||
+                         (std::is_bounded_array_v<Y> &&
+                          std::is_convertible_v<std::remove_extent_t<Y> (*)[], T*>)> {};
+
+// Whether a `SharedPtr<T>` can take ownership of a raw `Y*`: `Y(*)[]` must convert to `T*` if
+// `T` is `U[]`, `Y(*)[N]` if `T` is `U[N]`, and `Y*` otherwise.
+template <typename Y, typename T>
+struct IsOwnablePointer : std::is_convertible<Y*, T*> {};
+template <typename Y, typename U>
+struct IsOwnablePointer<Y, U[]> : std::is_convertible<Y (*)[], U (*)[]> {};
+template <typename Y, typename U, size_t N>
+struct IsOwnablePointer<Y, U[N]> : std::is_convertible<Y (*)[N], U (*)[N]> {};
+
+// Modes of `EnableSharedFromThis`: keep a `WeakPtr` to the object in the object,
+// or find the block from the address of the object (see `EnableSharedFromThis<T, LocateBlock>`).
+struct StoreWeakThis;
+struct LocateBlock;
+
+class EnableSharedFromThisBase {};
+class LocatedSharedFromThisBase : public EnableSharedFromThisBase {};
+template <typename T, typename Mode = StoreWeakThis>
 class EnableSharedFromThis;
 
-class BaseBlock {
-public:
-    virtual void IncStrongCounter() = 0;
-    virtual void IncWeakCounter() = 0;
-    virtual void DecStrongCounter() = 0;
-    virtual void DecWeakCounter() = 0;
-    virtual size_t GetStrongCounter() const = 0;
-    virtual size_t GetWeakCounter() const = 0;
-    virtual ~BaseBlock() {
-    }
-};
+class BiasedBlockBase;
+class BiasedOwner;
 
+// Allocator of control blocks when the user gives none: `PoolAllocator` when compiled with
+// `SMART_PTRS_POOLED_BLOCKS` (see `BlockPool`), `std::allocator` otherwise.
+#ifdef SMART_PTRS_POOLED_BLOCKS
+template <class T>
+using DefaultBlockAllocator = PoolAllocator<std::remove_cv_t<T>>;
+#else
 template <class T>
-class BlockPointer : public BaseBlock {
+using DefaultBlockAllocator = std::allocator<std::remove_cv_t<T>>;
+#endif
+
+// Counters are atomic, so `SharedPtr`/`WeakPtr` copies to the same block may live in different
+// threads. Increments are relaxed: a new reference can only be made from an existing one, so
+// nothing has to be ordered with it. Decrements are acq_rel, so the thread that drops the last
+// reference sees every write made through the other ones before it destroys anything.
+//
+// Counting is not virtual: the only thing that depends on the concrete block is how to destroy
+// the object and how to free the block, and both go through a single `DestroyHook` set up by
+// the derived block. Copies and most destructions of `SharedPtr` are plain inlined arithmetic.
+//
+// `weak_counter_` holds one extra reference on behalf of all strong owners together.
+// It is released right after the object is destroyed, so the block can't go away
+// while the destructor of the object is still running.
+//
+// Per-block flags share words with the counters, so checking them costs no extra space in the
+// block. The deferred flag is in the top bits of `weak_counter_`: only the last release reads
+// it. The biased flag, read by every strong count change, is the lowest bit of
+// `strong_counter_`, which counts in steps of `kStrongOne`: copies and drops of `SharedPtr`
+// never read the weak counter, which `SplitLayout` can then keep on another cache line.
+//
+// With `SMART_PTRS_PACKED_COUNTERS` defined, both counters share one 64-bit word instead:
+// the strong count in the low 32 bits, the weak count and both flags in the high ones. That
+// saves 8 bytes per block and lets the sole owner of a block without weak references see so
+// with a single load and free everything without any atomic read-modify-write. Counts are
+// limited to 2^31 strong and 2^29 weak references; going past that throws `std::overflow_error`.
+//
+// With `SMART_PTRS_FLAT_TEARDOWN` defined, objects are destroyed through `FlatTeardown`, so
+// dropping the head of a long chain of `SharedPtr`s doesn't recurse once per node.
+class BaseBlock {
+    friend class BiasedBlockBase;
+    friend class BiasedOwner;
+
 public:
-    BlockPointer(T* obj) : strong_counter_(1), weak_counter_(0), object_(obj) {
+    enum class DestroyAction { kObject, kBlock };
+    using DestroyHook = void (*)(BaseBlock*, DestroyAction);
+
+    // Given by `BiasedBlockBase`, which counts strong references its own way (see below).
+    // Stored as `kStrongBiasedBit` of the strong word unless the counters are packed.
+    static constexpr size_t kBiasedFlag = size_t(1) << (sizeof(size_t) * 8 - 1);
+    // The object is destroyed through `DeferredQueue` instead of by its last owner.
+    static constexpr size_t kDeferredFlag = kBiasedFlag >> 1;
+    static constexpr size_t kFlagsMask = kBiasedFlag | kDeferredFlag;
+
+#ifdef SMART_PTRS_PACKED_COUNTERS
+    explicit BaseBlock(DestroyHook destroy, size_t flags = 0)
+        : counters_(kStrongOne | kWeakOne | flags), destroy_(destroy) {
     }
+#else
+    explicit BaseBlock(DestroyHook destroy, size_t flags = 0)
+        : strong_counter_((flags & kBiasedFlag) != 0 ? kStrongBiasedBit : kStrongOne),
+          weak_counter_(1 | (flags & ~kBiasedFlag)),
+          destroy_(destroy) {
+    }
+#endif
+    BaseBlock(const BaseBlock&) = delete;
+    BaseBlock& operator=(const BaseBlock&) = delete;
+
     void IncStrongCounter() {
-        ++strong_counter_;
+        Track<&BlockStats::OnStrongInc>();
+        ProfileRefcount(this);
+        if (IsBiased()) {
+            BiasedIncStrongCounter();
+            return;
+        }
+#ifdef SMART_PTRS_PACKED_COUNTERS
+        size_t word = counters_.fetch_add(kStrongOne, std::memory_order_relaxed) + kStrongOne;
+        if (word & kStrongGuard) {
+            counters_.fetch_sub(kStrongOne, std::memory_order_relaxed);
+            throw std::overflow_error("too many strong references");
+        }
+#else
+        strong_counter_.fetch_add(kStrongOne, std::memory_order_relaxed);
+#endif
+    }
+    // Increment strong counter only if the object is still alive.
+    // Returns false (and leaves counter untouched) if it has already expired.
+    bool IncStrongCounterIfNotZero() {
+        ProfileRefcount(this);
+        bool result =
+            IsBiased() ? BiasedIncStrongCounterIfNotZero() : IncStrongCounterIfNotZeroImpl();
+        if (result) {
+            Track<&BlockStats::OnStrongInc>();
+        }
+        return result;
     }
     void IncWeakCounter() {
-        ++weak_counter_;
+        Track<&BlockStats::OnWeakInc>();
+#ifdef SMART_PTRS_PACKED_COUNTERS
+        size_t word = counters_.fetch_add(kWeakOne, std::memory_order_relaxed) + kWeakOne;
+        if (word & kWeakGuard) {
+            counters_.fetch_sub(kWeakOne, std::memory_order_relaxed);
+            throw std::overflow_error("too many weak references");
+        }
+#else
+        weak_counter_.fetch_add(1, std::memory_order_relaxed);
+#endif
     }
     void DecStrongCounter() {
-        --strong_counter_;
-        if (strong_counter_ == 0) {
-            ++weak_counter_;
-            delete object_;
-            --weak_counter_;
-            if (weak_counter_ == 0) {
-                delete this;
-            }
+        Track<&BlockStats::OnStrongDec>();
+        ProfileRefcount(this);
+        if (IsBiased()) {
+            BiasedDecStrongCounter();
+            return;
+        }
+#ifdef SMART_PTRS_PACKED_COUNTERS
+        // The only reference there is: nobody can make another one, so there's nothing to count.
+        if (counters_.load(std::memory_order_acquire) == (kStrongOne | kWeakOne)) {
+            Teardown(&DestroyUnique);
+            return;
         }
+        if ((counters_.fetch_sub(kStrongOne, std::memory_order_acq_rel) & kStrongMask) == 1) {
+            ReleaseObject();
+        }
+#else
+        if (strong_counter_.fetch_sub(kStrongOne, std::memory_order_acq_rel) == kStrongOne) {
+            ReleaseObject();
+        }
+#endif
     }
     void DecWeakCounter() {
-        --weak_counter_;
-        if (weak_counter_ == 0 && strong_counter_ == 0) {
-            delete this;
-        }
+        Track<&BlockStats::OnWeakDec>();
+        ReleaseWeak();
     }
     size_t GetStrongCounter() const {
-        return strong_counter_;
+        if (IsBiased()) {
+            return BiasedGetStrongCounter();
+        }
+#ifdef SMART_PTRS_PACKED_COUNTERS
+        return counters_.load(std::memory_order_relaxed) & kStrongMask;
+#else
+        return strong_counter_.load(std::memory_order_relaxed) / kStrongOne;
+#endif
     }
     size_t GetWeakCounter() const {
+        size_t strong = GetStrongCounter();
+        return LoadWeak() - (strong != 0 ? 1 : 0);
+    }
+    bool IsBiased() const {
+#ifdef SMART_PTRS_PACKED_COUNTERS
+        return (counters_.load(std::memory_order_relaxed) & kBiasedFlag) != 0;
+#else
+        return (strong_counter_.load(std::memory_order_relaxed) & kStrongBiasedBit) != 0;
+#endif
+    }
+    // May be called at any time while the object is alive.
+    void DeferDestruction() {
+        WeakWord().fetch_or(kDeferredFlag, std::memory_order_relaxed);
+    }
+
+protected:
+    // Blocks are freed only through `destroy_`, which knows the concrete type.
+    ~BaseBlock() = default;
+
+    // Attribute the block to `T` in `BlockStats`. Called by the constructor of the derived block.
+    template <typename T>
+    void TrackAs() {
+#ifdef SMART_PTRS_BLOCK_STATS
+        stats_ = &BlockStats::For<T>();
+        created_ns_ = BlockStats::Now();
+        stats_->OnAllocate();
+#endif
+    }
+
+private:
+    // Compiles to nothing unless `SMART_PTRS_BLOCK_STATS` is defined.
+    template <auto Event>
+    void Track() {
+#ifdef SMART_PTRS_BLOCK_STATS
+        (stats_->*Event)();
+#endif
+    }
+
+    // Lowest bit of the strong word of a biased block, set for good. Ordinary blocks count in
+    // steps of `kStrongOne` and leave it clear.
+    static constexpr size_t kStrongBiasedBit = 1;
+
+#ifdef SMART_PTRS_PACKED_COUNTERS
+    static_assert(sizeof(size_t) == 8, "packed counters need a 64-bit size_t");
+
+    static constexpr size_t kStrongOne = 1;
+    static constexpr size_t kStrongMask = (size_t(1) << 32) - 1;
+    static constexpr size_t kStrongGuard = size_t(1) << 31;
+    static constexpr size_t kWeakShift = 32;
+    static constexpr size_t kWeakOne = size_t(1) << kWeakShift;
+    static constexpr size_t kWeakGuard = kDeferredFlag >> 1;
+
+    bool IncStrongCounterIfNotZeroImpl() {
+        size_t word = counters_.load(std::memory_order_relaxed);
+        while ((word & kStrongMask) != 0) {
+            if ((word + kStrongOne) & kStrongGuard) {
+                throw std::overflow_error("too many strong references");
+            }
+            if (counters_.compare_exchange_weak(word, word + kStrongOne, std::memory_order_acq_rel,
+                                                std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    void ReleaseWeak() {
+        size_t word = counters_.fetch_sub(kWeakOne, std::memory_order_acq_rel);
+        if ((word & ~kFlagsMask) >> kWeakShift == 1) {
+            Track<&BlockStats::OnFree>();
+            destroy_(this, DestroyAction::kBlock);
+        }
+    }
+    // The word holding the flags.
+    std::atomic<size_t>& WeakWord() {
+        return counters_;
+    }
+    size_t LoadWeakWord() const {
+        return counters_.load(std::memory_order_relaxed);
+    }
+    size_t LoadWeak() const {
+        return (LoadWeakWord() & ~kFlagsMask) >> kWeakShift;
+    }
+#else
+    static constexpr size_t kStrongOne = kStrongBiasedBit << 1;
+
+    bool IncStrongCounterIfNotZeroImpl() {
+        size_t count = strong_counter_.load(std::memory_order_relaxed);
+        while (count != 0) {
+            if (strong_counter_.compare_exchange_weak(count, count + kStrongOne,
+                                                      std::memory_order_acq_rel,
+                                                      std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    void ReleaseWeak() {
+        if ((weak_counter_.fetch_sub(1, std::memory_order_acq_rel) & ~kFlagsMask) == 1) {
+            Track<&BlockStats::OnFree>();
+            destroy_(this, DestroyAction::kBlock);
+        }
+    }
+    // The word holding the flags.
+    std::atomic<size_t>& WeakWord() {
         return weak_counter_;
     }
+    size_t LoadWeakWord() const {
+        return weak_counter_.load(std::memory_order_relaxed);
+    }
+    size_t LoadWeak() const {
+        return LoadWeakWord() & ~kFlagsMask;
+    }
+#endif
+    // Called once the last strong reference is gone.
+    void ReleaseObject() {
+        if (LoadWeakWord() & kDeferredFlag) {
+            DeferredQueue::Default().Push(this, &DestroyObject);
+            return;
+        }
+        Teardown(&DestroyObject);
+    }
+    void Teardown(FlatTeardown::DestroyFunc destroy) {
+#ifdef SMART_PTRS_FLAT_TEARDOWN
+        FlatTeardown::Destroy(this, destroy);
+#else
+        destroy(this);
+#endif
+    }
+    static void DestroyObject(void* ptr) {
+        auto* self = static_cast<BaseBlock*>(ptr);
+#ifdef SMART_PTRS_BLOCK_STATS
+        self->stats_->OnObjectDestroyed(self->created_ns_);
+#endif
+        self->destroy_(self, DestroyAction::kObject);
+        self->ReleaseWeak();
+    }
+#ifdef SMART_PTRS_PACKED_COUNTERS
+    // Destroy both the object and the block on behalf of their only reference.
+    static void DestroyUnique(void* ptr) {
+        auto* self = static_cast<BaseBlock*>(ptr);
+#ifdef SMART_PTRS_BLOCK_STATS
+        self->stats_->OnObjectDestroyed(self->created_ns_);
+#endif
+        self->destroy_(self, DestroyAction::kObject);
+        self->Track<&BlockStats::OnFree>();
+        self->destroy_(self, DestroyAction::kBlock);
+    }
+#endif
+
+    // Kept out of line: ordinary blocks never get there, and inlining biased code
+    // into every copy bloats it (and trips GCC's object size checks on smaller blocks).
+    void BiasedIncStrongCounter();
+    bool BiasedIncStrongCounterIfNotZero();
+    void BiasedDecStrongCounter();
+    size_t BiasedGetStrongCounter() const;
+
+#ifdef SMART_PTRS_PACKED_COUNTERS
+    std::atomic<size_t> counters_;
+#else
+    std::atomic<size_t> strong_counter_;
+    std::atomic<size_t> weak_counter_;
+#endif
+    DestroyHook destroy_;
+#ifdef SMART_PTRS_BLOCK_STATS
+    BlockStats* stats_ = nullptr;
+    int64_t created_ns_ = 0;
+#endif
+};
+
+// Biased reference counting: the thread that created the block (its owner) counts its own
+// references in `local_counter_` with plain loads and stores, every other thread uses the
+// atomic `strong_counter_`. The object is alive while the sum of both is not zero.
+//
+// `strong_counter_` of a biased block holds a signed count shifted by `kShift`, the biased bit
+// (see `BaseBlock::IsBiased`) and two flags:
+// - kMergedBit: the local counter has been folded into the shared one, after that every
+//   thread (the owner included) counts atomically and zero means the object is dead;
+// - kQueuedBit: the shared count went negative, i.e. another thread released references
+//   taken by the owner. The block is handed to the owner's queue, because only the owner
+//   may read its local counter and find out whether the sum dropped to zero.
+// The owner merges when its local counter drops to zero, when it drains its queue
+// (`DrainBiasedQueue()` or any owner-side release that notices pending blocks) and when
+// it exits. Blocks of an exited owner are merged by whichever thread queues them.
+class BiasedBlockBase : public BaseBlock {
+    friend class BaseBlock;
+    friend class BiasedOwner;
+
+public:
+    explicit BiasedBlockBase(DestroyHook destroy);
+
+protected:
+    ~BiasedBlockBase();
 
 private:
-    size_t strong_counter_;
-    size_t weak_counter_;
-    T* object_;
+    static constexpr size_t kMergedBit = kStrongBiasedBit << 1;
+    static constexpr size_t kQueuedBit = kStrongBiasedBit << 2;
+    static constexpr size_t kShift = 3;
+    static constexpr size_t kOne = size_t(1) << kShift;
+
+    static std::ptrdiff_t Shared(size_t word) {
+        return static_cast<std::ptrdiff_t>(word) >> kShift;
+    }
+    bool IsOwnerThread() const;
+    bool IsMerged() const {
+        return (strong_counter_.load(std::memory_order_relaxed) & kMergedBit) != 0;
+    }
+    size_t GetLocal() const {
+        return local_counter_.load(std::memory_order_relaxed);
+    }
+    void SetLocal(size_t value) {
+        local_counter_.store(value, std::memory_order_relaxed);
+    }
+
+    void IncStrong();
+    bool IncStrongIfNotZero();
+    void DecStrong();
+    void DecStrongShared();
+    void Merge();
+
+    BiasedOwner* owner_;
+    // Written only by the owner; atomic just so that `UseCount()` from other threads is not a race.
+    std::atomic<size_t> local_counter_;
+#ifdef SMART_PTRS_PACKED_COUNTERS
+    // The shared count and flags described above. Packed blocks have no word of this width.
+    std::atomic<size_t> strong_counter_;
+#endif
 };
 
-template <class T>
-class BlockObject : public BaseBlock {
+// Per-thread state of biased blocks: the queue other threads hand blocks to.
+// Shared by the thread and by every block it created, freed when the last of them goes away.
+class BiasedOwner {
 public:
-    template <typename... Args>
-    BlockObject(Args&&... args) : strong_counter_(1), weak_counter_(0) {
-        new (&object_) T(std::forward<Args>(args)...);
+    // The owner object of the calling thread, created on first use.
+    // Null once the thread has exited (i.e. in the thread-local destructors that run after).
+    static BiasedOwner* Current() {
+        Reference* reference = ThreadLocalCache<Reference>::Get();
+        return reference != nullptr ? reference->owner : nullptr;
     }
-    void IncStrongCounter() {
-        ++strong_counter_;
+    // Only compares against `Current()` without creating it.
+    static bool IsCurrent(const BiasedOwner* owner) {
+        Reference* reference = ThreadLocalCache<Reference>::Peek();
+        return reference != nullptr && reference->owner == owner;
     }
-    void IncWeakCounter() {
-        ++weak_counter_;
+
+    void Acquire() {
+        refs_.fetch_add(1, std::memory_order_relaxed);
     }
-    void DecStrongCounter() {
-        --strong_counter_;
-        if (strong_counter_ == 0) {
-            ++weak_counter_;
-            GetObserver()->~T();
-            --weak_counter_;
-            if (weak_counter_ == 0) {
-                delete this;
-            }
+    void Release() {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
         }
     }
-    void DecWeakCounter() {
-        --weak_counter_;
-        if (weak_counter_ == 0 && strong_counter_ == 0) {
-            delete this;
+    bool HasPending() const {
+        return pending_.load(std::memory_order_relaxed);
+    }
+
+    // Drop one shared reference of `block` that made its shared count negative.
+    void Enqueue(BiasedBlockBase* block);
+    // Merge every queued block. Called on the owner thread only.
+    void Drain();
+
+private:
+    // The thread's share of its owner object. By the time it is dropped, `Current()` is null:
+    // blocks the thread still releases count as released from elsewhere.
+    struct Reference {
+        Reference() : owner(new BiasedOwner()) {
+        }
+        ~Reference() {
+            owner->Exit();
+            owner->Release();
         }
+        BiasedOwner* owner;
+    };
+
+    BiasedOwner() = default;
+    void Exit();
+
+    std::mutex mutex_;
+    std::vector<BiasedBlockBase*> queue_;
+    bool exited_ = false;
+    std::atomic<bool> pending_ = false;
+    std::atomic<size_t> refs_ = 1;
+};
+
+inline BiasedBlockBase::BiasedBlockBase(DestroyHook destroy)
+    : BaseBlock(destroy, kBiasedFlag), owner_(BiasedOwner::Current()), local_counter_(1) {
+    strong_counter_.store(kStrongBiasedBit, std::memory_order_relaxed);
+    owner_->Acquire();
+}
+
+inline BiasedBlockBase::~BiasedBlockBase() {
+    owner_->Release();
+}
+
+inline bool BiasedBlockBase::IsOwnerThread() const {
+    return BiasedOwner::IsCurrent(owner_);
+}
+
+inline void BiasedBlockBase::IncStrong() {
+    if (IsOwnerThread() && !IsMerged()) {
+        SetLocal(GetLocal() + 1);
+    } else {
+        strong_counter_.fetch_add(kOne, std::memory_order_relaxed);
     }
-    size_t GetStrongCounter() const {
-        return strong_counter_;
+}
+
+// The owner's local counter is never zero while the block is not merged,
+// so until then the object is alive and any thread may take a reference.
+inline bool BiasedBlockBase::IncStrongIfNotZero() {
+    if (IsOwnerThread() && !IsMerged()) {
+        SetLocal(GetLocal() + 1);
+        return true;
     }
-    size_t GetWeakCounter() const {
-        return weak_counter_;
+    size_t word = strong_counter_.load(std::memory_order_relaxed);
+    while (!(word & kMergedBit) || Shared(word) != 0) {
+        if (strong_counter_.compare_exchange_weak(word, word + kOne, std::memory_order_acq_rel,
+                                                  std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void BiasedBlockBase::DecStrong() {
+    if (!IsOwnerThread() || IsMerged()) {
+        DecStrongShared();
+        return;
+    }
+    size_t local = GetLocal() - 1;
+    SetLocal(local);
+    if (local != 0) {
+        if (owner_->HasPending()) {
+            owner_->Drain();
+        }
+        return;
+    }
+    size_t word = strong_counter_.load(std::memory_order_relaxed);
+    do {
+        if (word & kQueuedBit) {
+            // Already in our queue: merge it from there, so the queue never holds a dead block.
+            owner_->Drain();
+            return;
+        }
+    } while (!strong_counter_.compare_exchange_weak(word, word | kMergedBit,
+                                                    std::memory_order_acq_rel,
+                                                    std::memory_order_relaxed));
+    if (Shared(word) == 0) {
+        ReleaseObject();
+    }
+}
+
+inline void BiasedBlockBase::DecStrongShared() {
+    size_t word = strong_counter_.load(std::memory_order_relaxed);
+    do {
+        if (!(word & (kMergedBit | kQueuedBit)) && Shared(word) < 1) {
+            owner_->Enqueue(this);
+            return;
+        }
+    } while (!strong_counter_.compare_exchange_weak(word, word - kOne, std::memory_order_acq_rel,
+                                                    std::memory_order_relaxed));
+    if ((word & kMergedBit) && Shared(word) == 1) {
+        ReleaseObject();
+    }
+}
+
+// Fold the local counter into the shared one for a queued block. Runs exactly once per block,
+// on the owner thread or, after the owner exited, on the thread that queued it.
+inline void BiasedBlockBase::Merge() {
+    size_t local = GetLocal();
+    SetLocal(0);
+    size_t word =
+        strong_counter_.fetch_add((local << kShift) | kMergedBit, std::memory_order_acq_rel);
+    if (Shared(word) + static_cast<std::ptrdiff_t>(local) == 0) {
+        ReleaseObject();
+    }
+}
+
+inline void BiasedOwner::Enqueue(BiasedBlockBase* block) {
+    std::unique_lock lock(mutex_);
+    size_t word = block->strong_counter_.load(std::memory_order_relaxed);
+    size_t next;
+    do {
+        next = word - BiasedBlockBase::kOne;
+        if (!(word & (BiasedBlockBase::kMergedBit | BiasedBlockBase::kQueuedBit)) &&
+            BiasedBlockBase::Shared(next) < 0) {
+            next |= BiasedBlockBase::kQueuedBit;
+        }
+    } while (!block->strong_counter_.compare_exchange_weak(word, next, std::memory_order_acq_rel,
+                                                           std::memory_order_relaxed));
+    if ((next & BiasedBlockBase::kQueuedBit) && !(word & BiasedBlockBase::kQueuedBit)) {
+        if (exited_) {
+            // Nobody touches the local counter anymore,
+            // and the mutex orders us after its last write.
+            lock.unlock();
+            block->Merge();
+        } else {
+            queue_.push_back(block);
+            pending_.store(true, std::memory_order_relaxed);
+        }
+        return;
+    }
+    lock.unlock();
+    if ((next & BiasedBlockBase::kMergedBit) && BiasedBlockBase::Shared(next) == 0) {
+        block->ReleaseObject();
+    }
+}
+
+inline void BiasedOwner::Drain() {
+    std::vector<BiasedBlockBase*> blocks;
+    {
+        std::lock_guard lock(mutex_);
+        blocks.swap(queue_);
+        pending_.store(false, std::memory_order_relaxed);
+    }
+    for (auto* block : blocks) {
+        block->Merge();
+    }
+}
+
+inline void BiasedOwner::Exit() {
+    std::vector<BiasedBlockBase*> blocks;
+    {
+        std::lock_guard lock(mutex_);
+        blocks.swap(queue_);
+        exited_ = true;
+    }
+    for (auto* block : blocks) {
+        block->Merge();
+    }
+}
+
+[[gnu::noinline]] inline void BaseBlock::BiasedIncStrongCounter() {
+    static_cast<BiasedBlockBase*>(this)->IncStrong();
+}
+
+[[gnu::noinline]] inline bool BaseBlock::BiasedIncStrongCounterIfNotZero() {
+    return static_cast<BiasedBlockBase*>(this)->IncStrongIfNotZero();
+}
+
+[[gnu::noinline]] inline void BaseBlock::BiasedDecStrongCounter() {
+    static_cast<BiasedBlockBase*>(this)->DecStrong();
+}
+
+[[gnu::noinline]] inline size_t BaseBlock::BiasedGetStrongCounter() const {
+    auto* self = static_cast<const BiasedBlockBase*>(this);
+    size_t word = self->strong_counter_.load(std::memory_order_relaxed);
+    if (word & BiasedBlockBase::kMergedBit) {
+        return BiasedBlockBase::Shared(word);
+    }
+    return BiasedBlockBase::Shared(word) + self->GetLocal();
+}
+
+// Merge blocks whose references were released by other threads into their shared counters,
+// destroying the ones nobody holds anymore. Owners also do this on their own when they notice
+// pending blocks or exit; call it at a quiet point to reclaim such objects sooner.
+inline void DrainBiasedQueue() {
+    if (BiasedOwner* owner = BiasedOwner::Current()) {
+        owner->Drain();
+    }
+}
+
+// Blocks of the `EnableSharedFromThis<T, LocateBlock>` objects that are not right before the
+// object: objects owned through a raw pointer (`BlockPointer`), biased blocks, blocks with
+// a stateful allocator. Entries are added by the owning `SharedPtr` and removed by the block
+// when it destroys the object. Lookups are skipped altogether while the registry is empty.
+class SharedFromThisRegistry {
+public:
+    static void Add(const LocatedSharedFromThisBase* object, BaseBlock* block) {
+        SharedFromThisRegistry& registry = Default();
+        std::lock_guard lock(registry.mutex_);
+        registry.blocks_.emplace(object, block);
+        registry.size_.store(registry.blocks_.size(), std::memory_order_relaxed);
+    }
+    static void Remove(const LocatedSharedFromThisBase* object) {
+        SharedFromThisRegistry& registry = Default();
+        if (registry.size_.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        std::lock_guard lock(registry.mutex_);
+        registry.blocks_.erase(object);
+        registry.size_.store(registry.blocks_.size(), std::memory_order_relaxed);
+    }
+    // Null if `object` is not registered.
+    static BaseBlock* Find(const LocatedSharedFromThisBase* object) {
+        SharedFromThisRegistry& registry = Default();
+        if (registry.size_.load(std::memory_order_relaxed) == 0) {
+            return nullptr;
+        }
+        std::lock_guard lock(registry.mutex_);
+        auto it = registry.blocks_.find(object);
+        return it != registry.blocks_.end() ? it->second : nullptr;
+    }
+
+private:
+    // Never destroyed: blocks may destroy objects during static destruction.
+    static SharedFromThisRegistry& Default() {
+        static SharedFromThisRegistry* registry = new SharedFromThisRegistry();
+        return *registry;
+    }
+
+    std::mutex mutex_;
+    std::unordered_map<const LocatedSharedFromThisBase*, BaseBlock*> blocks_;
+    std::atomic<size_t> size_ = 0;
+};
+
+// Owns an object created elsewhere and destroys it with `Deleter`.
+// The block is obtained from `Alloc` rebound to the block type. Both the deleter and the
+// allocator are kept compressed, so stateless ones take no space in the block.
+template <class T, class Deleter, class Alloc>
+class BlockPointer : public BaseBlock, private CPElem<Alloc, 0> {
+    using AllocElem = CPElem<Alloc, 0>;
+    using BlockAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<BlockPointer>;
+    using BlockAllocTraits = std::allocator_traits<BlockAlloc>;
+
+public:
+    // Takes ownership of `obj` even if the block can't be allocated:
+    // in that case `obj` is destroyed with `deleter` and the exception is rethrown.
+    static BlockPointer* Create(T* obj, Deleter deleter, const Alloc& alloc) {
+        BlockAlloc block_alloc(alloc);
+        BlockPointer* block;
+        try {
+            block = std::to_address(BlockAllocTraits::allocate(block_alloc, 1));
+        } catch (...) {
+            deleter(obj);
+            throw;
+        }
+        new (block) BlockPointer(obj, std::move(deleter), alloc);
+        return block;
+    }
+    // Takes over the object and the deleter of the unique pointer `owner` only once the block
+    // is made: if that throws, `owner` still owns the object.
+    template <class Owner>
+    static BlockPointer* Adopt(Owner& owner, const Alloc& alloc) {
+        BlockAlloc block_alloc(alloc);
+        BlockPointer* block = std::to_address(BlockAllocTraits::allocate(block_alloc, 1));
+        try {
+            new (block) BlockPointer(owner.Get(), std::move(owner.GetDeleter()), alloc);
+        } catch (...) {
+            BlockAllocTraits::deallocate(block_alloc, block, 1);
+            throw;
+        }
+        owner.Release();
+        return block;
+    }
+
+private:
+    BlockPointer(T* obj, Deleter&& deleter, const Alloc& alloc)
+        : BaseBlock(&Destroy), AllocElem(alloc), pair_(obj, std::move(deleter)) {
+        TrackAs<T>();
+    }
+    static void Destroy(BaseBlock* base, DestroyAction action) {
+        auto* self = static_cast<BlockPointer*>(base);
+        if (action == DestroyAction::kObject) {
+            if constexpr (std::is_convertible_v<T*, const LocatedSharedFromThisBase*>) {
+                SharedFromThisRegistry::Remove(self->pair_.GetFirst());
+            }
+            self->pair_.GetSecond()(self->pair_.GetFirst());
+        } else {
+            BlockAlloc block_alloc(self->AllocElem::Get());
+            self->~BlockPointer();
+            BlockAllocTraits::deallocate(block_alloc, self, 1);
+        }
+    }
+
+    CompressedPair<T*, Deleter> pair_;
+};
+
+// Layouts of `BlockObject`, i.e. where the counters and the object go within the allocation.
+// With the default one the counters share a cache line with the first bytes of the object,
+// so threads copying the pointer and threads writing to the object invalidate each other's
+// caches (false sharing). Choose another layout per type by specializing `BlockLayoutOf`.
+//
+// The counters right before the object: the smallest block.
+struct ColocatedLayout {
+    static constexpr size_t kLeadingPadding = 0;
+    static constexpr size_t kObjectAlignment = 1;
+};
+// The object starts on the cache line after the counters, and the block ends on a line boundary,
+// so the object shares its lines with nothing else.
+struct PaddedLayout {
+    static constexpr size_t kCacheLine = 64;
+    static constexpr size_t kLeadingPadding = 0;
+    static constexpr size_t kObjectAlignment = kCacheLine;
+};
+// Like `PaddedLayout`, and the strong counter ends one cache line while the weak one (with the
+// rest of the block) starts the next, so `WeakPtr` traffic doesn't contend with copies of
+// `SharedPtr`s either. Costs one more line. Packed counters can't be split: same as padded.
+struct SplitLayout {
+#ifdef SMART_PTRS_PACKED_COUNTERS
+    static constexpr size_t kLeadingPadding = 0;
+#else
+    static constexpr size_t kLeadingPadding =
+        PaddedLayout::kCacheLine - sizeof(std::atomic<size_t>);
+#endif
+    static constexpr size_t kObjectAlignment = PaddedLayout::kCacheLine;
+};
+
+// The layout of the blocks `MakeShared<T>`, `AllocateShared<T>` and `MakeSharedBiased<T>` make.
+template <class T>
+struct BlockLayoutOf {
+    using Type = ColocatedLayout;
+};
+
+// Bytes in front of the counters of a block.
+template <size_t Size>
+struct BlockPadding {
+    unsigned char padding[Size];
+};
+template <>
+struct BlockPadding<0> {};
+
+// Object and counters share one allocation, obtained from `Alloc` rebound to the block type.
+// The allocator lives inside the block (empty ones take no space) and is used both to
+// construct/destroy the object and to free the block.
+// `Base` selects the counting scheme: `BaseBlock` or `BiasedBlockBase`, `Layout` where
+// the counters and the object are placed.
+template <class T, class Alloc = DefaultBlockAllocator<T>, class Base = BaseBlock,
+          class Layout = typename BlockLayoutOf<std::remove_cv_t<T>>::Type>
+class BlockObject : private BlockPadding<Layout::kLeadingPadding>,
+                    public Base,
+                    private CPElem<Alloc, 0> {
+    using AllocElem = CPElem<Alloc, 0>;
+    using AllocTraits = std::allocator_traits<Alloc>;
+    using BlockAlloc = typename AllocTraits::template rebind_alloc<BlockObject>;
+    using BlockAllocTraits = std::allocator_traits<BlockAlloc>;
+
+public:
+    template <typename... Args>
+    static BlockObject* Create(const Alloc& alloc, Args&&... args) {
+        BlockAlloc block_alloc(alloc);
+        BlockObject* block = std::to_address(BlockAllocTraits::allocate(block_alloc, 1));
+        try {
+            new (block) BlockObject(alloc, std::forward<Args>(args)...);
+        } catch (...) {
+            BlockAllocTraits::deallocate(block_alloc, block, 1);
+            throw;
+        }
+        return block;
     }
     T* GetObserver() {
         return reinterpret_cast<T*>(&object_);
     }
 
 private:
-    size_t strong_counter_;
-    size_t weak_counter_;
-    std::aligned_storage_t<sizeof(T), alignof(T)> object_;
-};
\ No newline at end of file
+    template <typename... Args>
+    BlockObject(const Alloc& alloc, Args&&... args) : Base(&Destroy), AllocElem(alloc) {
+        AllocTraits::construct(GetAllocator(), GetMutableObject(), std::forward<Args>(args)...);
+        this->template TrackAs<T>();
+    }
+    Alloc& GetAllocator() {
+        return AllocElem::Get();
+    }
+    std::remove_cv_t<T>* GetMutableObject() {
+        return reinterpret_cast<std::remove_cv_t<T>*>(&object_);
+    }
+    static void Destroy(BaseBlock* base, BaseBlock::DestroyAction action) {
+        auto* self = static_cast<BlockObject*>(base);
+        if (action == BaseBlock::DestroyAction::kObject) {
+            if constexpr (std::is_convertible_v<T*, const LocatedSharedFromThisBase*>) {
+                SharedFromThisRegistry::Remove(self->GetObserver());
+            }
+            AllocTraits::destroy(self->GetAllocator(), self->GetMutableObject());
+        } else {
+            BlockAlloc block_alloc(self->GetAllocator());
+            self->~BlockObject();
+            BlockAllocTraits::deallocate(block_alloc, self, 1);
+        }
+    }
+
+    alignas(std::max(Layout::kObjectAlignment, alignof(T)))
+        std::aligned_storage_t<sizeof(T), alignof(T)> object_;
+};
+
+// `size` elements and the counters share one allocation: the elements follow the block,
+// aligned for `T`. The memory comes from `Alloc` rebound to a storage unit aligned for both,
+// the elements are constructed through `Alloc` in order and destroyed in reverse order.
+template <class T, class Alloc = DefaultBlockAllocator<T>>
+class BlockArray : public BaseBlock, private CPElem<Alloc, 0> {
+    static_assert(!std::is_array_v<T>, "multidimensional arrays are not supported");
+
+    struct Unit;
+    using AllocElem = CPElem<Alloc, 0>;
+    using AllocTraits = std::allocator_traits<Alloc>;
+    using UnitAlloc = typename AllocTraits::template rebind_alloc<Unit>;
+    using UnitAllocTraits = std::allocator_traits<UnitAlloc>;
+
+public:
+    // Every element is value-initialised or, if given, a copy of `init`.
+    template <typename... Init>
+    static BlockArray* Create(const Alloc& alloc, size_t size, const Init&... init) {
+        static_assert(sizeof...(Init) <= 1);
+        UnitAlloc unit_alloc(alloc);
+        size_t units = UnitCount(size);
+        auto* block = reinterpret_cast<BlockArray*>(
+            std::to_address(UnitAllocTraits::allocate(unit_alloc, units)));
+        try {
+            new (block) BlockArray(alloc, size, init...);
+        } catch (...) {
+            UnitAllocTraits::deallocate(unit_alloc, reinterpret_cast<Unit*>(block), units);
+            throw;
+        }
+        return block;
+    }
+    T* GetObserver() {
+        return GetMutableElements();
+    }
+
+private:
+    template <typename... Init>
+    BlockArray(const Alloc& alloc, size_t size, const Init&... init)
+        : BaseBlock(&Destroy), AllocElem(alloc), size_(size) {
+        size_t constructed = 0;
+        try {
+            for (; constructed < size_; ++constructed) {
+                AllocTraits::construct(GetAllocator(), GetMutableElements() + constructed, init...);
+            }
+        } catch (...) {
+            DestroyElements(constructed);
+            throw;
+        }
+        TrackAs<T[]>();
+    }
+    static constexpr size_t ElementsOffset() {
+        return (sizeof(BlockArray) + alignof(T) - 1) / alignof(T) * alignof(T);
+    }
+    static size_t UnitCount(size_t size) {
+        constexpr size_t kMaxSize =
+            (std::numeric_limits<size_t>::max() - ElementsOffset() - sizeof(Unit)) / sizeof(T);
+        if (size > kMaxSize) {
+            throw std::bad_array_new_length();
+        }
+        return (ElementsOffset() + size * sizeof(T) + sizeof(Unit) - 1) / sizeof(Unit);
+    }
+    Alloc& GetAllocator() {
+        return AllocElem::Get();
+    }
+    std::remove_cv_t<T>* GetMutableElements() {
+        return reinterpret_cast<std::remove_cv_t<T>*>(reinterpret_cast<unsigned char*>(this) +
+                                                      ElementsOffset());
+    }
+    void DestroyElements(size_t count) {
+        while (count != 0) {
+            --count;
+            AllocTraits::destroy(GetAllocator(), GetMutableElements() + count);
+        }
+    }
+    static void Destroy(BaseBlock* base, DestroyAction action) {
+        auto* self = static_cast<BlockArray*>(base);
+        if (action == DestroyAction::kObject) {
+            self->DestroyElements(self->size_);
+        } else {
+            UnitAlloc unit_alloc(self->GetAllocator());
+            size_t units = UnitCount(self->size_);
+            self->~BlockArray();
+            UnitAllocTraits::deallocate(unit_alloc, reinterpret_cast<Unit*>(self), units);
+        }
+    }
+
+    size_t size_;
+};
+
+template <class T, class Alloc>
+struct alignas(std::max(alignof(BlockArray<T, Alloc>), alignof(T))) BlockArray<T, Alloc>::Unit {
+    unsigned char bytes[std::max(alignof(BlockArray<T, Alloc>), alignof(T))];
+};
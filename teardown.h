@@ -0,0 +1,63 @@
+#pragma once
+
+#include "thread_local_cache.h"
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// Destroys long ownership chains (lists, deep trees) iteratively instead of recursively.
+// The first destruction on a thread runs as usual; whatever it releases that has to be
+// destroyed too is only put on a per-thread worklist, and the outermost call destroys the
+// listed objects one by one. So a chain of any length nests at most two destructors deep.
+//
+// The price is the order: an object released by a destructor is destroyed after that
+// destructor returns instead of during it. Used by `FlatDelete`, `FlatSlug` and, with
+// `SMART_PTRS_FLAT_TEARDOWN` defined, by the control blocks of `SharedPtr`.
+class FlatTeardown {
+public:
+    using DestroyFunc = void (*)(void*);
+
+    static void Destroy(void* object, DestroyFunc destroy) {
+        Worklist* list = GetWorklist();
+        if (list == nullptr) {
+            destroy(object);
+            return;
+        }
+        if (list->active) {
+            try {
+                list->items.push_back({object, destroy});
+                return;
+            } catch (const std::bad_alloc&) {
+                // No memory for the list: fall back to recursion rather than leak.
+            }
+            destroy(object);
+            return;
+        }
+        list->active = true;
+        destroy(object);
+        while (!list->items.empty()) {
+            Item item = list->items.back();
+            list->items.pop_back();
+            item.destroy(item.object);
+        }
+        list->active = false;
+    }
+
+private:
+    struct Item {
+        void* object;
+        DestroyFunc destroy;
+    };
+    // Kept for the lifetime of the thread, so the storage is reused by the next teardown.
+    // Destructions after the thread's worklist is gone (from other thread-local destructors)
+    // just recurse.
+    struct Worklist {
+        std::vector<Item> items;
+        bool active = false;
+    };
+
+    static Worklist* GetWorklist() {
+        return ThreadLocalCache<Worklist>::Get();
+    }
+};
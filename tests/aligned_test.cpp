@@ -0,0 +1,171 @@
+// Aligned and huge-page buffers: the alignment asked for, zero-filled memory, each deleter
+// returning memory to where its allocator took it from, and the huge-page path falling back step
+// by step when the system refuses huge pages, `madvise` or `mmap` altogether. The fallbacks are
+// forced by replacing `mmap`, `munmap` and `madvise` for this program.
+
+#include "aligned.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define CHECK(condition)                                                                     \
+    do {                                                                                     \
+        if (!(condition)) {                                                                  \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            std::abort();                                                                    \
+        }                                                                                    \
+    } while (false)
+
+// One word each: the deleters are empty.
+static_assert(std::is_same_v<decltype(MakeUniqueAligned<float[]>(1, 64)),
+                             UniquePtr<float[], AlignedFree>>);
+static_assert(std::is_same_v<decltype(MakeUniqueAlignedForOverwrite<float[]>(1, 64)),
+                             UniquePtr<float[], AlignedFree>>);
+static_assert(std::is_same_v<decltype(MakeUniqueHugePages<float[]>(1)),
+                             UniquePtr<float[], HugePageFree>>);
+static_assert(sizeof(UniquePtr<float[], AlignedFree>) == sizeof(void*));
+static_assert(sizeof(UniquePtr<float[], HugePageFree>) == sizeof(void*));
+
+static bool IsAligned(const void* ptr, size_t alignment) {
+    return reinterpret_cast<uintptr_t>(ptr) % alignment == 0;
+}
+
+static void TestAligned() {
+    for (size_t alignment : {1, 8, 64, 4096}) {
+        auto buffer = MakeUniqueAligned<double[]>(1000, alignment);
+        CHECK(IsAligned(buffer.Get(), alignment) && IsAligned(buffer.Get(), alignof(double)));
+        for (size_t i = 0; i < 1000; ++i) {
+            CHECK(buffer[i] == 0);
+        }
+        auto overwrite = MakeUniqueAlignedForOverwrite<char[]>(3, alignment);
+        CHECK(IsAligned(overwrite.Get(), alignment));
+    }
+    CHECK(MakeUniqueAligned<int[]>(0, 64).Get() != nullptr);
+
+    bool thrown = false;
+    try {
+        MakeUniqueAligned<int[]>(1, 48);
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    thrown = false;
+    try {
+        MakeUniqueAligned<int[]>(SIZE_MAX / 2, 64);
+    } catch (const std::bad_array_new_length&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+#if defined(__linux__)
+
+// What the replaced system calls refuse, and what they were asked for.
+static bool refuse_hugetlb = false;
+static bool refuse_mmap = false;
+static bool refuse_madvise = false;
+static int hugetlb_maps = 0;
+static int plain_maps = 0;
+static int madvise_calls = 0;
+static size_t unmapped_bytes = 0;
+
+extern "C" void* mmap(void* address, size_t length, int protection, int flags, int fd,
+                      off_t offset) noexcept {
+    if ((flags & MAP_HUGETLB) != 0) {
+        ++hugetlb_maps;
+    } else {
+        ++plain_maps;
+    }
+    if (refuse_mmap || (refuse_hugetlb && (flags & MAP_HUGETLB) != 0)) {
+        errno = ENOMEM;
+        return MAP_FAILED;
+    }
+    return reinterpret_cast<void*>(
+        syscall(SYS_mmap, address, length, protection, flags, fd, offset));
+}
+extern "C" int munmap(void* address, size_t length) noexcept {
+    unmapped_bytes += length;
+    return static_cast<int>(syscall(SYS_munmap, address, length));
+}
+extern "C" int madvise(void* address, size_t length, int advice) noexcept {
+    ++madvise_calls;
+    if (refuse_madvise) {
+        errno = EINVAL;
+        return -1;
+    }
+    return static_cast<int>(syscall(SYS_madvise, address, length, advice));
+}
+
+static void ResetCalls() {
+    hugetlb_maps = plain_maps = madvise_calls = 0;
+    unmapped_bytes = 0;
+}
+
+// Write all of the buffer, check that it came zeroed, and free it through its deleter.
+static void UseHugePages(size_t n) {
+    auto buffer = MakeUniqueHugePages<uint64_t[]>(n);
+    CHECK(IsAligned(buffer.Get(), HugePages::kDataOffset));
+    for (size_t i = 0; i < n; ++i) {
+        CHECK(buffer[i] == 0);
+        buffer[i] = i;
+    }
+}
+
+static void TestHugePages() {
+    constexpr size_t kElements = (size_t(3) << 20) / sizeof(uint64_t);
+    constexpr size_t kLength = size_t(4) << 20;  // 3 MiB and the header, in 2 MiB pages
+
+    // Reserved huge pages, or transparent ones, whichever the system gives.
+    ResetCalls();
+    UseHugePages(kElements);
+    CHECK(hugetlb_maps == 1 && unmapped_bytes >= kLength);
+
+    // No reserved huge pages: an aligned range with the hint, trimmed to the length.
+    refuse_hugetlb = true;
+    ResetCalls();
+    UseHugePages(kElements);
+    CHECK(hugetlb_maps == 1 && plain_maps == 1 && madvise_calls == 1);
+    CHECK(unmapped_bytes == kLength + HugePages::kHugePageSize);
+
+    // The hint refused: regular pages will do.
+    refuse_madvise = true;
+    ResetCalls();
+    UseHugePages(kElements);
+    CHECK(plain_maps == 1 && madvise_calls == 1);
+
+    // No `mmap` at all: heap memory, given back with `free` rather than `munmap`.
+    refuse_mmap = true;
+    ResetCalls();
+    UseHugePages(kElements);
+    UseHugePages(1);
+    CHECK(hugetlb_maps == 2 && plain_maps == 2 && madvise_calls == 0 && unmapped_bytes == 0);
+
+    refuse_hugetlb = refuse_mmap = refuse_madvise = false;
+}
+
+#else
+
+static void TestHugePages() {
+    auto buffer = MakeUniqueHugePages<uint64_t[]>(1000);
+    CHECK(IsAligned(buffer.Get(), HugePages::kDataOffset) && buffer[999] == 0);
+}
+
+#endif
+
+int main() {
+    TestAligned();
+    TestHugePages();
+    std::printf("aligned buffers: ok\n");
+    return 0;
+}
@@ -0,0 +1,141 @@
+// Multi-threaded stress test of `AtomicSharedPtr`: loads racing with stores, exchanges and
+// compare-exchanges of one slot. Every value loaded must be alive, no increment made through
+// `CompareExchange` may be lost, and every value must be destroyed exactly once.
+//
+// Usage: atomic_shared_test [rounds]
+
+#include "atomic_shared.h"
+#include "shared.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#define CHECK(condition)                                                                     \
+    do {                                                                                     \
+        if (!(condition)) {                                                                  \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            std::abort();                                                                    \
+        }                                                                                    \
+    } while (false)
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Helpers
+
+// Counts the live values; `magic` tells a live value from a destroyed one.
+struct Value {
+    static constexpr int kAlive = 0x600d;
+    static constexpr int kDead = 0xdead;
+    static inline std::atomic<int> live = 0;
+
+    explicit Value(int id) : id(id) {
+        live.fetch_add(1, std::memory_order_relaxed);
+    }
+    ~Value() {
+        CHECK(magic == kAlive);
+        magic = kDead;
+        live.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    const int id;
+    volatile int magic = kAlive;
+};
+
+static int ThreadCount() {
+    return std::max(4, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+// Run `body(index)` on `threads` threads, released at once, and wait for all of them.
+template <class Body>
+static void OnThreads(int threads, Body body) {
+    std::atomic<bool> start = false;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back([&, i] {
+            while (!start.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            body(i);
+        });
+    }
+    start.store(true, std::memory_order_release);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Tests
+
+// Half of the threads increment the id with `CompareExchange`, the others load. Every increment
+// lands exactly once, and a reader never sees the id go back.
+static void TestIncrements(int rounds) {
+    int threads = ThreadCount();
+    int writers = threads / 2;
+    int increments = rounds * 10;
+    AtomicSharedPtr<Value> slot(MakeShared<Value>(0));
+    OnThreads(threads, [&](int index) {
+        if (index < writers) {
+            for (int i = 0; i < increments; ++i) {
+                SharedPtr<Value> expected = slot.Load();
+                while (!slot.CompareExchange(expected, MakeShared<Value>(expected->id + 1))) {
+                    CHECK(expected->magic == Value::kAlive);
+                }
+            }
+            return;
+        }
+        int last = 0;
+        for (int i = 0; i < increments * 4; ++i) {
+            SharedPtr<Value> value = slot.Load();
+            CHECK(value->magic == Value::kAlive);
+            CHECK(value->id >= last);
+            last = value->id;
+        }
+    });
+    CHECK(slot.Load()->id == writers * increments);
+    CHECK(Value::live.load() == 1);
+}
+
+// Every operation at once, null values included: whatever comes out of the slot is alive.
+static void TestMixed(int rounds) {
+    {
+        AtomicSharedPtr<Value> slot;
+        OnThreads(ThreadCount(), [&](int index) {
+            for (int i = 0; i < rounds * 20; ++i) {
+                switch ((index + i) % 4) {
+                    case 0:
+                        slot.Store(i % 5 == 0 ? SharedPtr<Value>() : MakeShared<Value>(i));
+                        break;
+                    case 1: {
+                        SharedPtr<Value> old = slot.Exchange(MakeShared<Value>(i));
+                        CHECK(!old || old->magic == Value::kAlive);
+                        break;
+                    }
+                    case 2: {
+                        SharedPtr<Value> expected = slot.Load();
+                        slot.CompareExchange(expected, MakeShared<Value>(i));
+                        CHECK(!expected || expected->magic == Value::kAlive);
+                        break;
+                    }
+                    default: {
+                        SharedPtr<Value> value = slot.Load();
+                        CHECK(!value || value->magic == Value::kAlive);
+                    }
+                }
+            }
+        });
+        CHECK(Value::live.load() <= 1);
+    }
+    CHECK(Value::live.load() == 0);
+}
+
+int main(int argc, char** argv) {
+    int rounds = argc > 1 ? std::atoi(argv[1]) : 200;
+    TestIncrements(rounds);
+    TestMixed(rounds);
+    std::printf("AtomicSharedPtr: ok\n");
+    return 0;
+}
@@ -0,0 +1,120 @@
+// Control block statistics: live and peak blocks, allocations, strong and weak counts, and
+// lifetimes, per type. Built with `SMART_PTRS_BLOCK_STATS`, once per counting scheme.
+
+#include "shared.h"
+#include "weak.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define CHECK(condition)                                                                     \
+    do {                                                                                     \
+        if (!(condition)) {                                                                  \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            std::abort();                                                                    \
+        }                                                                                    \
+    } while (false)
+
+// One type per test, so that each starts from zero.
+struct Copied {
+    int value = 0;
+};
+struct Batched {
+    int value = 0;
+};
+struct Observed {
+    int value = 0;
+};
+struct Adopted {
+    int value = 0;
+};
+
+static BlockStatsSnapshot Find(const std::string& type_name) {
+    for (const BlockStatsSnapshot& stats : GetBlockStats()) {
+        if (stats.type_name == type_name) {
+            return stats;
+        }
+    }
+    std::fprintf(stderr, "no statistics for %s\n", type_name.c_str());
+    std::abort();
+}
+
+static uint64_t Lifetimes(const BlockStatsSnapshot& stats) {
+    uint64_t total = 0;
+    for (uint64_t count : stats.lifetime_ns_log2) {
+        total += count;
+    }
+    return total;
+}
+
+// The reference the block starts with counts as an increment.
+static void TestCopies() {
+    {
+        auto first = MakeShared<Copied>();
+        SharedPtr<Copied> second(first);
+        SharedPtr<Copied> third = second;
+        BlockStatsSnapshot stats = Find("Copied");
+        CHECK(stats.live_blocks == 1 && stats.strong_inc == 3 && stats.strong_dec == 0);
+        CHECK(Lifetimes(stats) == 0);
+    }
+    BlockStatsSnapshot stats = Find("Copied");
+    CHECK(stats.live_blocks == 0 && stats.peak_live_blocks == 1 && stats.allocations == 1);
+    CHECK(stats.strong_inc == 3 && stats.strong_dec == 3);
+    CHECK(stats.weak_inc == 0 && stats.weak_dec == 0);
+    CHECK(Lifetimes(stats) == 1);
+}
+
+static void TestPeak() {
+    std::vector<SharedPtr<Batched>> batch;
+    for (int i = 0; i < 5; ++i) {
+        batch.push_back(MakeShared<Batched>());
+    }
+    CHECK(Find("Batched").live_blocks == 5);
+    batch.clear();
+    batch.push_back(MakeShared<Batched>());
+    BlockStatsSnapshot stats = Find("Batched");
+    CHECK(stats.live_blocks == 1 && stats.peak_live_blocks == 5 && stats.allocations == 6);
+    CHECK(stats.strong_inc == 6 && stats.strong_dec == 5);
+    CHECK(Lifetimes(stats) == 5);
+}
+
+// The block outlives the object while weak references remain; a failed lock counts as nothing.
+static void TestWeak() {
+    auto owner = MakeShared<Observed>();
+    WeakPtr<Observed> weak(owner);
+    CHECK(weak.Lock());
+    owner.Reset();
+    CHECK(!weak.Lock());
+    BlockStatsSnapshot stats = Find("Observed");
+    CHECK(stats.live_blocks == 1 && Lifetimes(stats) == 1);
+    CHECK(stats.strong_inc == 2 && stats.strong_dec == 2);
+    CHECK(stats.weak_inc == 1 && stats.weak_dec == 0);
+    weak.Reset();
+    stats = Find("Observed");
+    CHECK(stats.live_blocks == 0 && stats.weak_inc == 1 && stats.weak_dec == 1);
+}
+
+// Blocks of adopted pointers are counted like those of `MakeShared`.
+static void TestAdopted() {
+    SharedPtr<Adopted>(new Adopted()).Reset();
+    BlockStatsSnapshot stats = Find("Adopted");
+    CHECK(stats.live_blocks == 0 && stats.allocations == 1);
+    CHECK(stats.strong_inc == 1 && stats.strong_dec == 1);
+
+    std::ostringstream out;
+    DumpBlockStats(out);
+    CHECK(out.str().find("Adopted: live 0, peak 1, allocations 1, strong +1/-1, weak +0/-0\n") !=
+          std::string::npos);
+}
+
+int main() {
+    TestCopies();
+    TestPeak();
+    TestWeak();
+    TestAdopted();
+    std::printf("block statistics: ok\n");
+    return 0;
+}
@@ -0,0 +1,122 @@
+// Which conversions between `SharedPtr`, `WeakPtr`, `SharedRef` and `IntrusiveRef` of different
+// types compile, and that the allowed ones keep pointing at the right object. The rules are the
+// ones of `std::shared_ptr`: arrays never convert to or from non-arrays, and `Derived[]` never
+// converts to `Base[]`.
+
+#include "borrow.h"
+#include "intrusive.h"
+#include "shared.h"
+#include "unique.h"
+#include "weak.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <type_traits>
+
+#define CHECK(condition)                                                                     \
+    do {                                                                                     \
+        if (!(condition)) {                                                                  \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            std::abort();                                                                    \
+        }                                                                                    \
+    } while (false)
+
+struct Base {
+    virtual ~Base() = default;
+    int value = 0;
+};
+struct Derived : Base {
+    int extra = 0;
+};
+
+struct Node : SimpleRefCounted<Node> {
+    virtual ~Node() = default;
+    int value = 0;
+};
+struct DerivedNode : Node {};
+struct Other : SimpleRefCounted<Other> {};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Rejected
+
+// `Derived[]` to `Base[]`: `operator[]` would step by `sizeof(Base)`.
+static_assert(!std::is_constructible_v<SharedPtr<Base[]>, const SharedPtr<Derived[]>&>);
+static_assert(!std::is_constructible_v<SharedPtr<Base[]>, SharedPtr<Derived[]>&&>);
+static_assert(!std::is_constructible_v<SharedPtr<Base[]>, Derived*>);
+static_assert(!std::is_constructible_v<SharedPtr<Base[]>, UniquePtr<Derived[]>&&>);
+static_assert(!std::is_constructible_v<WeakPtr<Base[]>, const SharedPtr<Derived[]>&>);
+static_assert(!std::is_constructible_v<WeakPtr<Base[]>, const WeakPtr<Derived[]>&>);
+static_assert(!std::is_constructible_v<SharedRef<Base[]>, const SharedPtr<Derived[]>&>);
+
+// Array to non-array and back.
+static_assert(!std::is_constructible_v<SharedPtr<Base>, const SharedPtr<Derived[]>&>);
+static_assert(!std::is_constructible_v<SharedPtr<Base>, SharedPtr<Derived[]>&&>);
+static_assert(!std::is_constructible_v<SharedPtr<int>, const SharedPtr<int[]>&>);
+static_assert(!std::is_constructible_v<SharedPtr<int[]>, const SharedPtr<int>&>);
+static_assert(!std::is_constructible_v<SharedPtr<int>, UniquePtr<int[]>&&>);
+static_assert(!std::is_constructible_v<SharedPtr<int[]>, UniquePtr<int>&&>);
+static_assert(!std::is_constructible_v<WeakPtr<int>, const SharedPtr<int[]>&>);
+static_assert(!std::is_constructible_v<WeakPtr<int[]>, const WeakPtr<int>&>);
+static_assert(!std::is_constructible_v<SharedRef<int>, const SharedPtr<int[]>&>);
+
+// Unrelated and base-to-derived intrusive types.
+static_assert(!std::is_constructible_v<IntrusiveRef<Node>, const IntrusivePtr<Other>&>);
+static_assert(!std::is_constructible_v<IntrusiveRef<Node>, const IntrusiveRef<Other>&>);
+static_assert(!std::is_constructible_v<IntrusiveRef<DerivedNode>, const IntrusivePtr<Node>&>);
+
+// Unknown bound to a known one, and constness away.
+static_assert(!std::is_constructible_v<SharedPtr<int[4]>, const SharedPtr<int[]>&>);
+static_assert(!std::is_constructible_v<SharedPtr<int[]>, const SharedPtr<const int[]>&>);
+static_assert(!std::is_constructible_v<SharedPtr<int[]>, const int*>);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Accepted
+
+static_assert(std::is_convertible_v<SharedPtr<Derived>, SharedPtr<Base>>);
+static_assert(std::is_convertible_v<WeakPtr<Derived>, WeakPtr<Base>>);
+static_assert(std::is_convertible_v<SharedPtr<Derived>, WeakPtr<Base>>);
+static_assert(std::is_convertible_v<SharedPtr<int[]>, SharedPtr<const int[]>>);
+static_assert(std::is_convertible_v<SharedPtr<int[4]>, SharedPtr<int[]>>);
+static_assert(std::is_convertible_v<SharedPtr<int[4]>, WeakPtr<const int[]>>);
+static_assert(std::is_convertible_v<UniquePtr<Derived>, SharedPtr<Base>>);
+static_assert(std::is_convertible_v<UniquePtr<int[]>, SharedPtr<const int[]>>);
+static_assert(std::is_constructible_v<SharedPtr<Base>, Derived*>);
+static_assert(std::is_constructible_v<SharedPtr<const int[]>, int*>);
+static_assert(std::is_convertible_v<const IntrusivePtr<DerivedNode>&, IntrusiveRef<Node>>);
+static_assert(std::is_convertible_v<IntrusiveRef<DerivedNode>, IntrusiveRef<const Node>>);
+
+// Borrows of temporaries, for the length of a call.
+static_assert(std::is_convertible_v<SharedPtr<Derived>, SharedRef<Base>>);
+static_assert(std::is_convertible_v<IntrusivePtr<DerivedNode>, IntrusiveRef<Node>>);
+
+static int Read(SharedRef<const Base> ref) {
+    return ref->value;
+}
+static int Read(IntrusiveRef<Node> ref) {
+    return ref->value;
+}
+
+int main() {
+    SharedPtr<Base> base(new Derived());
+    base->value = 1;
+    WeakPtr<Base> weak = SharedPtr<Derived>(MakeShared<Derived>());
+    CHECK(weak.Expired());
+
+    auto numbers = MakeShared<int[4]>();
+    for (int i = 0; i < 4; ++i) {
+        numbers[i] = i;
+    }
+    SharedPtr<const int[]> view(numbers);
+    WeakPtr<const int[]> weak_view(numbers);
+    SharedRef<const int[]> ref(numbers);
+    CHECK(numbers.UseCount() == 2);
+    CHECK(view[3] == 3 && weak_view.Lock()[2] == 2 && ref[1] == 1);
+
+    SharedPtr<const int[]> adopted(UniquePtr<int[]>(new int[2]{5, 6}));
+    CHECK(adopted[1] == 6 && adopted.UseCount() == 1);
+
+    CHECK(Read(MakeShared<Derived>()) == 0 && Read(MakeIntrusive<DerivedNode>()) == 0);
+
+    std::printf("conversions: ok\n");
+    return 0;
+}
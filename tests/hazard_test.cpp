@@ -0,0 +1,89 @@
+// Hazard pointers and `HazardDelete`: protected objects are not reclaimed, `TryOwn` doesn't
+// revive retired ones, and one `Reclaim()` frees a whole dropped chain.
+
+#include "hazard.h"
+#include "intrusive.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+
+#define CHECK(condition)                                                                     \
+    do {                                                                                     \
+        if (!(condition)) {                                                                  \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            std::abort();                                                                    \
+        }                                                                                    \
+    } while (false)
+
+struct Node : ThreadSafeRefCounted<Node, HazardDelete<>> {
+    static inline int live = 0;
+
+    Node() {
+        ++live;
+    }
+    ~Node() {
+        --live;
+    }
+
+    IntrusivePtr<Node> next;
+};
+
+// A protected object stays until the hazard pointer lets go of it.
+static void TestProtected() {
+    auto owner = MakeIntrusive<Node>();
+    std::atomic<Node*> slot = owner.Get();
+    HazardPointer hazard;
+    Node* node = hazard.Protect(slot);
+    CHECK(node == owner.Get());
+    slot.store(nullptr);
+    owner.Reset();
+    HazardDomain::Default().Reclaim();
+    CHECK(Node::live == 1);
+    hazard.Reset();
+    HazardDomain::Default().Reclaim();
+    CHECK(Node::live == 0);
+}
+
+// `TryOwn` takes a reference while there is one, and fails once the object is retired.
+static void TestTryOwn() {
+    auto owner = MakeIntrusive<Node>();
+    std::atomic<Node*> slot = owner.Get();
+    HazardPointer hazard;
+    Node* node = hazard.Protect(slot);
+
+    IntrusivePtr<Node> owned = hazard.TryOwn(node);
+    CHECK(owned.Get() == node && node->RefCount() == 2);
+    owned.Reset();
+
+    owner.Reset();
+    CHECK(node->RefCount() == 0);
+    CHECK(!hazard.TryOwn(node));
+    CHECK(node->RefCount() == 0);
+    hazard.Reset();
+    HazardDomain::Default().Reclaim();
+    CHECK(Node::live == 0);
+}
+
+// Each node is retired only once its predecessor is reclaimed: one call frees them all.
+static void TestChain() {
+    constexpr int kLength = 1000;
+    IntrusivePtr<Node> head;
+    for (int i = 0; i < kLength; ++i) {
+        auto node = MakeIntrusive<Node>();
+        node->next = std::move(head);
+        head = std::move(node);
+    }
+    head.Reset();
+    CHECK(Node::live == kLength);
+    HazardDomain::Default().Reclaim();
+    CHECK(Node::live == 0);
+}
+
+int main() {
+    TestProtected();
+    TestTryOwn();
+    TestChain();
+    std::printf("hazard pointers: ok\n");
+    return 0;
+}
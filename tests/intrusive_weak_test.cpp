@@ -0,0 +1,167 @@
+// `WeakRefCounted` objects and `IntrusiveWeakPtr`: the object goes with the last strong
+// reference, its memory with the last weak one, for over-aligned and polymorphic types too, and
+// a throwing constructor leaves nothing behind.
+
+#include "intrusive.h"
+#include "intrusive_weak.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#define CHECK(condition)                                                                     \
+    do {                                                                                     \
+        if (!(condition)) {                                                                  \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            std::abort();                                                                    \
+        }                                                                                    \
+    } while (false)
+
+// Blocks are allocated with an explicit alignment: count those allocations. The helpers are out
+// of line so that the compiler doesn't pair `free` with the `operator new` it came from.
+static std::atomic<int> live_allocations = 0;
+
+[[gnu::noinline]] static void* AllocateAligned(size_t size, size_t alignment) {
+    void* memory = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    ++live_allocations;
+    return memory;
+}
+[[gnu::noinline]] static void FreeAligned(void* memory) {
+    --live_allocations;
+    std::free(memory);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return AllocateAligned(size, static_cast<size_t>(alignment));
+}
+void operator delete(void* memory, std::align_val_t) noexcept {
+    FreeAligned(memory);
+}
+void operator delete(void* memory, size_t, std::align_val_t) noexcept {
+    FreeAligned(memory);
+}
+
+struct Node : WeakRefCounted<Node> {
+    static inline int live = 0;
+
+    Node() {
+        ++live;
+    }
+    ~Node() {
+        --live;
+    }
+
+    int value = 1;
+};
+
+struct alignas(64) Wide : WeakRefCounted<Wide> {
+    int value = 2;
+};
+
+struct Base : WeakRefCounted<Base> {
+    virtual ~Base() = default;
+    int value = 3;
+};
+struct Other {
+    virtual ~Other() = default;
+    long padding = 0;
+};
+// `Base` is not at the start of the object.
+struct Derived : Other, Base {
+    static inline int live = 0;
+
+    Derived() {
+        ++live;
+    }
+    ~Derived() override {
+        --live;
+    }
+};
+
+struct Throwing : WeakRefCounted<Throwing> {
+    Throwing() {
+        throw 42;
+    }
+};
+
+static void TestLock() {
+    auto owner = MakeIntrusive<Node>();
+    IntrusiveWeakPtr<Node> weak(owner);
+    CHECK(!weak.Expired() && weak.UseCount() == 1);
+    IntrusivePtr<Node> locked = weak.Lock();
+    CHECK(locked.Get() == owner.Get() && owner->RefCount() == 2);
+    locked.Reset();
+    owner.Reset();
+    CHECK(Node::live == 0 && weak.Expired() && !weak.Lock());
+    CHECK(!IntrusiveWeakPtr<Node>().Lock());
+}
+
+// The object is destroyed with the last strong reference, the memory freed with the last weak.
+static void TestMemory() {
+    int allocations = live_allocations;
+    auto owner = MakeIntrusive<Node>();
+    CHECK(live_allocations == allocations + 1);
+    IntrusiveWeakPtr<Node> first(owner);
+    IntrusiveWeakPtr<Node> second = first;
+    owner.Reset();
+    CHECK(Node::live == 0 && live_allocations == allocations + 1);
+    first.Reset();
+    CHECK(live_allocations == allocations + 1);
+    second.Reset();
+    CHECK(live_allocations == allocations);
+}
+
+// The block is not right at the start of the allocation.
+static void TestOverAligned() {
+    int allocations = live_allocations;
+    auto owner = MakeIntrusive<Wide>();
+    CHECK(reinterpret_cast<uintptr_t>(owner.Get()) % 64 == 0 && owner->value == 2);
+    IntrusiveWeakPtr<Wide> weak(owner);
+    CHECK(weak.Lock().Get() == owner.Get());
+    CHECK(owner->RefCount() == 1);
+    owner.Reset();
+    CHECK(weak.Expired() && !weak.Lock());
+    weak.Reset();
+    CHECK(live_allocations == allocations);
+}
+
+// Through `Base`, the block is found from the start of `Derived`.
+static void TestPolymorphic() {
+    int allocations = live_allocations;
+    IntrusivePtr<Base> owner = MakeIntrusive<Derived>();
+    CHECK(static_cast<void*>(owner.Get()) != dynamic_cast<void*>(owner.Get()));
+    IntrusiveWeakPtr<Base> weak(owner);
+    IntrusivePtr<Base> locked = weak.Lock();
+    CHECK(locked.Get() == owner.Get() && locked->value == 3 && owner->RefCount() == 2);
+    locked.Reset();
+    owner.Reset();
+    CHECK(Derived::live == 0 && !weak.Lock());
+    weak.Reset();
+    CHECK(live_allocations == allocations);
+}
+
+static void TestThrowingConstructor() {
+    int allocations = live_allocations;
+    bool thrown = false;
+    try {
+        MakeIntrusive<Throwing>();
+    } catch (int) {
+        thrown = true;
+    }
+    CHECK(thrown && live_allocations == allocations);
+}
+
+int main() {
+    TestLock();
+    TestMemory();
+    TestOverAligned();
+    TestPolymorphic();
+    TestThrowingConstructor();
+    std::printf("intrusive weak pointers: ok\n");
+    return 0;
+}
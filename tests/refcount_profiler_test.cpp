@@ -0,0 +1,80 @@
+// `RefcountProfiler` with period 1: a known set of copies on two threads shows up sample for
+// sample, a new period applies at once on threads that are already counting down, and period 0
+// stops sampling. Built with `SMART_PTRS_REFCOUNT_PROFILER`.
+
+#include "shared.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#define CHECK(condition)                                                                     \
+    do {                                                                                     \
+        if (!(condition)) {                                                                  \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            std::abort();                                                                    \
+        }                                                                                    \
+    } while (false)
+
+// `copies` copies of `ptr`, each an increment and a decrement.
+static void CopyAndDrop(const SharedPtr<int>& ptr, int copies) {
+    for (int i = 0; i < copies; ++i) {
+        SharedPtr<int> copy(ptr);
+        CHECK(*copy == 1);
+    }
+}
+
+static size_t TotalSamples() {
+    size_t total = 0;
+    for (const auto& block : RefcountProfiler::Default().TopBlocks(100)) {
+        total += block.samples;
+    }
+    return total;
+}
+
+int main() {
+    RefcountProfiler& profiler = RefcountProfiler::Default();
+    auto shared = MakeShared<int>(1);
+    auto local = MakeShared<int>(1);
+
+    // Both threads are well into the default countdown when the period changes.
+    CopyAndDrop(local, 10);
+    std::thread other([&] { CopyAndDrop(shared, 10); });
+    other.join();
+
+    profiler.SetPeriod(1);
+    profiler.Clear();
+    CopyAndDrop(local, 10);
+    CHECK(TotalSamples() == 20);
+
+    // `shared` on two threads, `local` on this one only.
+    std::thread first([&] { CopyAndDrop(shared, 100); });
+    first.join();
+    CopyAndDrop(shared, 100);
+    CopyAndDrop(local, 40);
+
+    auto blocks = profiler.TopBlocks(10);
+    CHECK(blocks.size() == 2);
+    CHECK(blocks[0].samples == 400 && blocks[0].threads == 2 && blocks[0].thread_switches == 1);
+    CHECK(blocks[1].samples == 100 && blocks[1].threads == 1 && blocks[1].thread_switches == 0);
+
+    // Every sample has a call site, and only the copies of `shared` are contended.
+    size_t samples = 0;
+    size_t contended = 0;
+    for (const auto& site : profiler.TopCallSites(100)) {
+        samples += site.samples;
+        contended += site.contended_samples;
+    }
+    CHECK(samples == 500 && contended == 400);
+    CHECK(profiler.TopCallSites(1)[0].contended_samples > 0);
+
+    profiler.SetPeriod(0);
+    CopyAndDrop(shared, 10);
+    CHECK(TotalSamples() == 500);
+    profiler.SetPeriod(2);
+    CopyAndDrop(shared, 10);
+    CHECK(TotalSamples() == 510);
+
+    std::printf("refcount profiler: ok\n");
+    return 0;
+}
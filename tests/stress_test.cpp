@@ -0,0 +1,220 @@
+// Multi-threaded stress test of the control block counters: copies and drops of one pointer
+// from many threads at once, `WeakPtr::Lock` and promotion racing with the last drop, and weak
+// references outliving the object. Stops at the first broken invariant.
+//
+// Usage: stress_test [rounds]
+
+#include "shared.h"
+#include "weak.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#define CHECK(condition)                                                                     \
+    do {                                                                                     \
+        if (!(condition)) {                                                                  \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            std::abort();                                                                    \
+        }                                                                                    \
+    } while (false)
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Helpers
+
+// Counts the live objects; `magic` tells a live object from a destroyed one whose block is
+// still held by weak references.
+struct Tracked {
+    static constexpr int kAlive = 0x600d;
+    static constexpr int kDead = 0xdead;
+    static inline std::atomic<int> live = 0;
+
+    Tracked() {
+        live.fetch_add(1, std::memory_order_relaxed);
+    }
+    ~Tracked() {
+        CHECK(magic == kAlive);
+        magic = kDead;
+        live.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    volatile int magic = kAlive;
+};
+
+// Counts the blocks alive, so that a leaked or doubly freed block shows up.
+template <class T>
+struct CountingAllocator {
+    using value_type = T;
+    static inline std::atomic<int> blocks = 0;
+
+    CountingAllocator() = default;
+    template <class U>
+    CountingAllocator(const CountingAllocator<U>&) {
+    }
+    T* allocate(size_t n) {
+        CountingAllocator<void>::blocks.fetch_add(1, std::memory_order_relaxed);
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* ptr, size_t n) {
+        CountingAllocator<void>::blocks.fetch_sub(1, std::memory_order_relaxed);
+        std::allocator<T>().deallocate(ptr, n);
+    }
+    template <class U>
+    bool operator==(const CountingAllocator<U>&) const {
+        return true;
+    }
+};
+
+static int ThreadCount() {
+    return std::max(4, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+// Run `body(index)` on `threads` threads, released at once, and wait for all of them.
+template <class Body>
+static void OnThreads(int threads, Body body) {
+    std::atomic<bool> start = false;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back([&, i] {
+            while (!start.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            body(i);
+        });
+    }
+    start.store(true, std::memory_order_release);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// The ways to make a block.
+static SharedPtr<Tracked> MakeCounted() {
+    return AllocateShared<Tracked>(CountingAllocator<Tracked>());
+}
+static SharedPtr<Tracked> MakeFromPointer() {
+    return SharedPtr<Tracked>(new Tracked(), Slug<Tracked>(), CountingAllocator<Tracked>());
+}
+static SharedPtr<Tracked> MakeBiased() {
+    return MakeSharedBiased<Tracked>();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Tests
+
+// Every thread copies and drops one pointer: the count must come back to where it was.
+template <class Make>
+static void TestCopies(Make make, int rounds) {
+    auto shared = make();
+    OnThreads(ThreadCount(), [&](int) {
+        for (int i = 0; i < rounds * 100; ++i) {
+            SharedPtr<Tracked> copy(shared);
+            WeakPtr<Tracked> weak(copy);
+            SharedPtr<Tracked> locked = weak.Lock();
+            CHECK(locked && locked->magic == Tracked::kAlive);
+        }
+    });
+    DrainBiasedQueue();
+    CHECK(shared.UseCount() == 1);
+}
+
+// The owners drop their copies at the same time: exactly one of them destroys the object.
+template <class Make>
+static void TestLastDrop(Make make, int rounds) {
+    int threads = ThreadCount();
+    for (int round = 0; round < rounds; ++round) {
+        auto shared = make();
+        std::vector<SharedPtr<Tracked>> copies(threads, shared);
+        WeakPtr<Tracked> weak(shared);
+        shared.Reset();
+        OnThreads(threads, [&](int index) { copies[index].Reset(); });
+        DrainBiasedQueue();
+        CHECK(weak.Expired());
+        CHECK(!weak.Lock());
+    }
+}
+
+// Readers lock a weak pointer while the last owner goes away. A lock either fails or returns
+// a live object, and once one has failed, none succeeds again.
+template <class Make>
+static void TestLockRace(Make make, int rounds) {
+    int threads = ThreadCount();
+    for (int round = 0; round < rounds; ++round) {
+        auto shared = make();
+        WeakPtr<Tracked> weak(shared);
+        OnThreads(threads, [&](int index) {
+            if (index == 0) {
+                shared.Reset();
+                return;
+            }
+            bool expired = false;
+            for (int i = 0; i < 1000; ++i) {
+                SharedPtr<Tracked> locked = weak.Lock();
+                if (locked) {
+                    CHECK(!expired);
+                    CHECK(locked->magic == Tracked::kAlive);
+                } else {
+                    expired = true;
+                }
+                try {
+                    SharedPtr<Tracked> promoted(weak);
+                    CHECK(!expired);
+                    CHECK(promoted->magic == Tracked::kAlive);
+                } catch (const BadWeakPtr&) {
+                    expired = true;
+                }
+            }
+        });
+        DrainBiasedQueue();
+        CHECK(weak.Expired());
+    }
+}
+
+// Strong and weak references are copied and dropped together: the block goes away only after
+// the last of both, exactly once.
+template <class Make>
+static void TestWeakOutlives(Make make, int rounds) {
+    int threads = ThreadCount();
+    for (int round = 0; round < rounds; ++round) {
+        auto shared = make();
+        std::vector<SharedPtr<Tracked>> strong(threads, shared);
+        std::vector<WeakPtr<Tracked>> weak(threads, WeakPtr<Tracked>(shared));
+        shared.Reset();
+        OnThreads(threads, [&](int index) {
+            WeakPtr<Tracked> copy(weak[index]);
+            if (index % 2 == 0) {
+                weak[index].Reset();
+                strong[index].Reset();
+            } else {
+                strong[index].Reset();
+                weak[index].Reset();
+            }
+            (void)copy.Lock();
+        });
+        DrainBiasedQueue();
+    }
+}
+
+template <class Make>
+static void Run(const char* name, Make make, int rounds) {
+    TestCopies(make, rounds);
+    TestLastDrop(make, rounds);
+    TestLockRace(make, rounds);
+    TestWeakOutlives(make, rounds);
+    CHECK(Tracked::live.load() == 0);
+    CHECK(CountingAllocator<void>::blocks.load() == 0);
+    std::printf("%s: ok\n", name);
+}
+
+int main(int argc, char** argv) {
+    int rounds = argc > 1 ? std::atoi(argv[1]) : 200;
+    Run("MakeShared", &MakeCounted, rounds);
+    Run("SharedPtr(new T)", &MakeFromPointer, rounds);
+    Run("MakeSharedBiased", &MakeBiased, rounds);
+    return 0;
+}
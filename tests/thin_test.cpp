@@ -0,0 +1,125 @@
+// `ThinSharedPtr` and `ThinWeakPtr`: one word each, sharing counts with the `SharedPtr`s of the
+// same block, and `BadThinPtr` for pointers whose object is not where the block says.
+
+#include "shared.h"
+#include "thin.h"
+#include "weak.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+
+#define CHECK(condition)                                                                     \
+    do {                                                                                     \
+        if (!(condition)) {                                                                  \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            std::abort();                                                                    \
+        }                                                                                    \
+    } while (false)
+
+struct Pair {
+    static inline int live = 0;
+
+    Pair(int first, int second) : first(first), second(second) {
+        ++live;
+    }
+    Pair(const Pair& other) : first(other.first), second(other.second) {
+        ++live;
+    }
+    ~Pair() {
+        --live;
+    }
+
+    int first;
+    int second;
+};
+
+static_assert(sizeof(ThinSharedPtr<Pair>) == sizeof(void*));
+static_assert(sizeof(ThinWeakPtr<Pair>) == sizeof(void*));
+
+static void TestConstruction() {
+    ThinSharedPtr<Pair> empty;
+    ThinSharedPtr<Pair> null = nullptr;
+    CHECK(!empty && !null && empty.Get() == nullptr && empty.UseCount() == 0);
+
+    auto thin = MakeThinShared<Pair>(1, 2);
+    CHECK(thin && thin->first == 1 && (*thin).second == 2 && thin.UseCount() == 1);
+
+    auto shared = MakeShared<Pair>(3, 4);
+    ThinSharedPtr<Pair> copied(shared);
+    CHECK(copied.Get() == shared.Get() && shared.UseCount() == 2);
+    ThinSharedPtr<Pair> moved(std::move(shared));
+    CHECK(!shared && moved == copied && moved.UseCount() == 2);
+
+    SharedPtr<Pair> back = std::move(moved).ToShared();
+    CHECK(!moved && back.Get() == copied.Get() && back.UseCount() == 2);
+    SharedPtr<Pair> again = copied.ToShared();
+    CHECK(again.Get() == copied.Get() && back.UseCount() == 3);
+    CHECK(ThinSharedPtr<Pair>(SharedPtr<Pair>()).Get() == nullptr);
+}
+
+static void TestCopy() {
+    auto first = MakeThinShared<Pair>(1, 2);
+    ThinSharedPtr<Pair> second = first;
+    CHECK(second == first && first.UseCount() == 2);
+    ThinSharedPtr<Pair> third;
+    third = second;
+    CHECK(first.UseCount() == 3);
+    third = std::move(second);
+    CHECK(!second && first.UseCount() == 2);
+    first.Reset();
+    CHECK(!first && third.UseCount() == 1 && Pair::live == 1);
+    third.Reset();
+    CHECK(Pair::live == 0);
+}
+
+// The object goes with the last strong reference, the block with the last weak one.
+static void TestLock() {
+    auto owner = MakeThinShared<Pair>(1, 2);
+    ThinWeakPtr<Pair> weak(owner);
+    ThinWeakPtr<Pair> other = weak;
+    CHECK(!weak.Expired() && weak.UseCount() == 1);
+    ThinSharedPtr<Pair> locked = weak.Lock();
+    CHECK(locked == owner && owner.UseCount() == 2);
+    locked.Reset();
+    owner.Reset();
+    CHECK(Pair::live == 0 && weak.Expired() && other.Expired());
+    CHECK(!weak.Lock() && !other.Lock());
+    CHECK(!ThinWeakPtr<Pair>().Lock());
+}
+
+// Adopted and aliased pointers have their object elsewhere.
+static void TestBadThinPtr() {
+    SharedPtr<Pair> adopted(new Pair(1, 2));
+    CHECK(!ThinSharedPtr<Pair>::IsThin(adopted));
+    bool thrown = false;
+    try {
+        ThinSharedPtr<Pair> thin(adopted);
+    } catch (const BadThinPtr&) {
+        thrown = true;
+    }
+    CHECK(thrown && adopted.UseCount() == 1);
+
+    auto owner = MakeShared<Pair>(3, 4);
+    SharedPtr<Pair> alias(owner, owner.Get() + 0);
+    CHECK(ThinSharedPtr<Pair>::IsThin(alias));
+    SharedPtr<Pair> elsewhere(owner, adopted.Get());
+    CHECK(!ThinSharedPtr<Pair>::IsThin(elsewhere));
+    thrown = false;
+    try {
+        ThinSharedPtr<Pair> thin(std::move(elsewhere));
+    } catch (const BadThinPtr&) {
+        thrown = true;
+    }
+    CHECK(thrown && elsewhere && owner.UseCount() == 3);
+}
+
+int main() {
+    TestConstruction();
+    TestCopy();
+    TestLock();
+    TestBadThinPtr();
+    CHECK(Pair::live == 0);
+    std::printf("thin pointers: ok\n");
+    return 0;
+}
@@ -0,0 +1,92 @@
+// `MakeUnique` and `MakeUniqueForOverwrite`: objects built from their arguments, arrays of
+// unknown bound with one object per element, value-initialised by `MakeUnique`, and arrays of
+// known bound rejected at compile time.
+
+#include "unique.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#define CHECK(condition)                                                                     \
+    do {                                                                                     \
+        if (!(condition)) {                                                                  \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            std::abort();                                                                    \
+        }                                                                                    \
+    } while (false)
+
+template <class T>
+concept CanMakeUnique = requires { MakeUnique<T>(size_t(4)); };
+template <class T>
+concept CanMakeUniqueForOverwrite = requires { MakeUniqueForOverwrite<T>(); };
+
+static_assert(CanMakeUnique<int> && CanMakeUnique<int[]>);
+static_assert(!CanMakeUnique<int[4]>);
+static_assert(CanMakeUniqueForOverwrite<int>);
+static_assert(!CanMakeUniqueForOverwrite<int[4]>);
+static_assert(std::is_same_v<decltype(MakeUnique<int[]>(4)), UniquePtr<int[]>>);
+static_assert(std::is_same_v<decltype(MakeUniqueForOverwrite<int[]>(4)), UniquePtr<int[]>>);
+
+struct Counted {
+    static inline int live = 0;
+
+    Counted() {
+        ++live;
+    }
+    Counted(std::string name, int number) : name(std::move(name)), number(number) {
+        ++live;
+    }
+    ~Counted() {
+        --live;
+    }
+
+    std::string name = "default";
+    int number = 0;
+};
+
+static void TestScalar() {
+    auto counted = MakeUnique<Counted>("made", 7);
+    CHECK(counted->name == "made" && counted->number == 7 && Counted::live == 1);
+    auto number = MakeUnique<int>();
+    CHECK(*number == 0);
+
+    auto overwrite = MakeUniqueForOverwrite<Counted>();
+    CHECK(overwrite->name == "default" && Counted::live == 2);
+    counted.Reset();
+    overwrite.Reset();
+    CHECK(Counted::live == 0);
+}
+
+static void TestArray() {
+    // Leave garbage behind for `MakeUnique` to find, should it skip the zero fill.
+    {
+        auto dirty = MakeUniqueForOverwrite<int[]>(1000);
+        for (int i = 0; i < 1000; ++i) {
+            dirty[i] = -1;
+        }
+    }
+    auto zeros = MakeUnique<int[]>(1000);
+    for (int i = 0; i < 1000; ++i) {
+        CHECK(zeros[i] == 0);
+    }
+
+    auto counted = MakeUnique<Counted[]>(3);
+    CHECK(Counted::live == 3 && counted[2].name == "default");
+    auto overwrite = MakeUniqueForOverwrite<Counted[]>(2);
+    CHECK(Counted::live == 5 && overwrite[1].number == 0);
+    counted.Reset();
+    overwrite.Reset();
+    CHECK(Counted::live == 0);
+
+    CHECK(MakeUnique<int[]>(0).Get() != nullptr);
+}
+
+int main() {
+    TestScalar();
+    TestArray();
+    std::printf("unique pointers: ok\n");
+    return 0;
+}
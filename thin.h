@@ -0,0 +1,238 @@
+#pragma once
+
+#include "shared.h"
+#include "weak.h"
+
+#include <cstddef>  // std::nullptr_t
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+class BadThinPtr : public std::exception {};
+
+// One-word `SharedPtr` for objects made by `MakeShared` (or `MakeThinShared`) and not aliased.
+// Only the block is stored: the object sits at a fixed offset inside `BlockObject`, so `Get()`
+// is a single addition. Halves the footprint of large tables of pointers.
+// Converts from a `SharedPtr` whose object is where the block says it is (see `IsThin`),
+// and back to `SharedPtr` in both directions without touching the counters when moving.
+template <typename T>
+class ThinSharedPtr {
+    static_assert(!std::is_array_v<T>, "arrays are not supported");
+
+    template <typename Y>
+    friend class ThinSharedPtr;
+    template <typename Y>
+    friend class ThinWeakPtr;
+
+    using Block = BlockObject<std::remove_cv_t<T>, DefaultBlockAllocator<T>>;
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    ThinSharedPtr() : block_(nullptr) {
+    }
+    ThinSharedPtr(std::nullptr_t) : block_(nullptr) {
+    }
+    // Throw `BadThinPtr` unless `IsThin(other)`.
+    explicit ThinSharedPtr(const SharedPtr<T>& other) : block_(GetThinBlock(other)) {
+        if (block_ != nullptr) {
+            block_->IncStrongCounter();
+        }
+    }
+    explicit ThinSharedPtr(SharedPtr<T>&& other) : block_(GetThinBlock(other)) {
+        other.block_ = nullptr;
+        other.observer_ = nullptr;
+    }
+
+    ThinSharedPtr(const ThinSharedPtr& other) : block_(other.block_) {
+        if (block_ != nullptr) {
+            block_->IncStrongCounter();
+        }
+    }
+    ThinSharedPtr(ThinSharedPtr&& other) noexcept : block_(std::exchange(other.block_, nullptr)) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    ThinSharedPtr& operator=(const ThinSharedPtr& other) {
+        ThinSharedPtr(other).Swap(*this);
+        return *this;
+    }
+    ThinSharedPtr& operator=(ThinSharedPtr&& other) noexcept {
+        ThinSharedPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~ThinSharedPtr() {
+        if (block_ != nullptr) {
+            block_->DecStrongCounter();
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        ThinSharedPtr().Swap(*this);
+    }
+    void Swap(ThinSharedPtr& other) noexcept {
+        std::swap(block_, other.block_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Conversions
+
+    // Whether `ptr` can be held by a `ThinSharedPtr`. Null pointers can.
+    // Only compares addresses: a block of another kind never has the object where `Block` would.
+    static bool IsThin(const SharedPtr<T>& ptr) {
+        return ptr.block_ == nullptr ||
+               static_cast<Block*>(ptr.block_)->GetObserver() == ptr.observer_;
+    }
+    SharedPtr<T> ToShared() const& {
+        return ThinSharedPtr(*this).ToShared();
+    }
+    SharedPtr<T> ToShared() && {
+        SharedPtr<T> result;
+        result.block_ = std::exchange(block_, nullptr);
+        result.observer_ = GetObject(static_cast<Block*>(result.block_));
+        return result;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const {
+        return GetObject(block_);
+    }
+    T& operator*() const {
+        return *block_->GetObserver();
+    }
+    T* operator->() const {
+        return block_->GetObserver();
+    }
+    size_t UseCount() const {
+        if (block_ != nullptr) {
+            return block_->GetStrongCounter();
+        }
+        return 0;
+    }
+    explicit operator bool() const {
+        return block_ != nullptr;
+    }
+
+private:
+    explicit ThinSharedPtr(Block* block) : block_(block) {
+    }
+
+    static Block* GetThinBlock(const SharedPtr<T>& ptr) {
+        if (!IsThin(ptr)) {
+            throw BadThinPtr();
+        }
+        return static_cast<Block*>(ptr.block_);
+    }
+    static T* GetObject(Block* block) {
+        return block != nullptr ? block->GetObserver() : nullptr;
+    }
+
+    Block* block_;
+};
+
+template <typename T>
+struct IsTriviallyRelocatable<ThinSharedPtr<T>> : std::true_type {};
+
+template <typename T, typename U>
+inline bool operator==(const ThinSharedPtr<T>& left, const ThinSharedPtr<U>& right) {
+    return left.Get() == right.Get();
+}
+
+// `MakeShared` straight into a `ThinSharedPtr`.
+template <typename T, typename... Args>
+ThinSharedPtr<T> MakeThinShared(Args&&... args) {
+    return ThinSharedPtr<T>(MakeShared<T>(std::forward<Args>(args)...));
+}
+
+// One-word `WeakPtr` observing what a `ThinSharedPtr` owns.
+template <typename T>
+class ThinWeakPtr {
+    using Block = typename ThinSharedPtr<T>::Block;
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    ThinWeakPtr() : block_(nullptr) {
+    }
+    ThinWeakPtr(const ThinSharedPtr<T>& other) : block_(other.block_) {
+        if (block_ != nullptr) {
+            block_->IncWeakCounter();
+        }
+    }
+    ThinWeakPtr(const ThinWeakPtr& other) : block_(other.block_) {
+        if (block_ != nullptr) {
+            block_->IncWeakCounter();
+        }
+    }
+    ThinWeakPtr(ThinWeakPtr&& other) noexcept : block_(std::exchange(other.block_, nullptr)) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    ThinWeakPtr& operator=(const ThinWeakPtr& other) {
+        ThinWeakPtr(other).Swap(*this);
+        return *this;
+    }
+    ThinWeakPtr& operator=(ThinWeakPtr&& other) noexcept {
+        ThinWeakPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~ThinWeakPtr() {
+        if (block_ != nullptr) {
+            block_->DecWeakCounter();
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        ThinWeakPtr().Swap(*this);
+    }
+    void Swap(ThinWeakPtr& other) noexcept {
+        std::swap(block_, other.block_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    size_t UseCount() const {
+        if (block_ != nullptr) {
+            return block_->GetStrongCounter();
+        }
+        return 0;
+    }
+    bool Expired() const {
+        return UseCount() == 0;
+    }
+    ThinSharedPtr<T> Lock() const {
+        if (block_ != nullptr && block_->IncStrongCounterIfNotZero()) {
+            return ThinSharedPtr<T>(block_);
+        }
+        return ThinSharedPtr<T>();
+    }
+
+private:
+    Block* block_;
+};
+
+template <typename T>
+struct IsTriviallyRelocatable<ThinWeakPtr<T>> : std::true_type {};
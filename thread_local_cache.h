@@ -0,0 +1,40 @@
+#pragma once
+
+// A `T` per thread, created on first use and destroyed when the thread exits.
+//
+// Other thread-local destructors may still run after that and reach for the `T`: from then on
+// `Get()` returns null instead of creating a new one that nobody would destroy, and callers
+// take their shared, thread-independent path. `Get()` already returns null while `~T` runs, so
+// whatever `~T` sets off (e.g. freeing blocks) takes that path too.
+//
+// One instance per `T`: users pass a nested type of their own.
+template <class T>
+class ThreadLocalCache {
+public:
+    // The calling thread's `T`, created on first use; null once the thread has exited.
+    static T* Get() {
+        if (current_ == nullptr && !exited_) {
+            thread_local Holder holder;
+        }
+        return current_;
+    }
+    // Like `Get()` but never creates the `T`.
+    static T* Peek() {
+        return current_;
+    }
+
+private:
+    struct Holder {
+        Holder() {
+            current_ = &value;
+        }
+        ~Holder() {
+            current_ = nullptr;
+            exited_ = true;
+        }
+        T value;
+    };
+
+    static inline thread_local T* current_ = nullptr;
+    static inline thread_local bool exited_ = false;
+};
@@ -1,8 +1,12 @@
 #pragma once
 
 #include "compressed_pair.h"
+#include "relocatable.h"
+#include "teardown.h"
 
-#include <cstddef>  // std::nullptr_t
+#include <cstddef>      // std::nullptr_t
+#include <type_traits>  // std::is_array_v
+#include <utility>      // std::forward
 
 template <class T>
 class Slug {
@@ -33,6 +37,25 @@ public:
     }
 };
 
+// Deletes like `Slug<T>`, but through `FlatTeardown`: a linked list or a tree of nodes owning
+// each other with `UniquePtr<Node, FlatSlug<Node>>` is destroyed iteratively.
+template <class T>
+class FlatSlug {
+public:
+    FlatSlug() = default;
+    template <class D>
+    requires std::is_base_of_v<T, D> FlatSlug(const FlatSlug<D>& other) {
+    }
+    void operator()(std::remove_extent_t<T>* p) const {
+        FlatTeardown::Destroy(p, &DestroyNow);
+    }
+
+private:
+    static void DestroyNow(void* p) {
+        Slug<T>()(static_cast<std::remove_extent_t<T>*>(p));
+    }
+};
+
 // Primary template
 template <class T, class Deleter = Slug<T>>
 class UniquePtr {
@@ -108,7 +131,7 @@ public:
             GetDeleter()(old_ptr);
         }
     }
-    void Swap(UniquePtr& other) {
+    void Swap(UniquePtr& other) noexcept {
         std::swap(pair_.GetFirst(), other.pair_.GetFirst());
         std::swap(pair_.GetSecond(), other.pair_.GetSecond());
     }
@@ -219,7 +242,7 @@ public:
             GetDeleter()(old_ptr);
         }
     }
-    void Swap(UniquePtr& other) {
+    void Swap(UniquePtr& other) noexcept {
         std::swap(pair_.GetFirst(), other.pair_.GetFirst());
         std::swap(pair_.GetSecond(), other.pair_.GetSecond());
     }
@@ -257,4 +280,35 @@ public:
 
 private:
     CompressedPair<T*, Deleter> pair_;
-};
\ No newline at end of file
+};
+
+// Relocatable as long as the deleter is: stateless deleters like `Slug` always are.
+template <class T, class Deleter>
+struct IsTriviallyRelocatable<UniquePtr<T, Deleter>> : IsTriviallyRelocatable<Deleter> {};
+
+// https://en.cppreference.com/w/cpp/memory/unique_ptr/make_unique
+// Objects are constructed from `args`, arrays of unknown bound have `n` value-initialised
+// elements. Arrays of known bound are not supported.
+template <typename T, typename... Args>
+requires(!std::is_array_v<T>) UniquePtr<T> MakeUnique(Args&&... args) {
+    return UniquePtr<T>(new T(std::forward<Args>(args)...));
+}
+template <typename T>
+requires std::is_unbounded_array_v<T> UniquePtr<T> MakeUnique(size_t n) {
+    return UniquePtr<T>(new std::remove_extent_t<T>[n]());
+}
+template <typename T, typename... Args>
+requires std::is_bounded_array_v<T> void MakeUnique(Args&&... args) = delete;
+
+// Same, but default-initialised: trivial types (and arrays of them) are left uninitialised,
+// so buffers that are about to be overwritten anyway skip the zero fill.
+template <typename T>
+requires(!std::is_array_v<T>) UniquePtr<T> MakeUniqueForOverwrite() {
+    return UniquePtr<T>(new T);
+}
+template <typename T>
+requires std::is_unbounded_array_v<T> UniquePtr<T> MakeUniqueForOverwrite(size_t n) {
+    return UniquePtr<T>(new std::remove_extent_t<T>[n]);
+}
+template <typename T, typename... Args>
+requires std::is_bounded_array_v<T> void MakeUniqueForOverwrite(Args&&... args) = delete;
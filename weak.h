@@ -1,5 +1,6 @@
 #pragma once
 
+#include "relocatable.h"
 #include "sw_fwd.h"  // Forward declaration
 
 // https://en.cppreference.com/w/cpp/memory/weak_ptr
@@ -9,8 +10,12 @@ class WeakPtr {
     friend class SharedPtr;
     template <typename Y>
     friend class WeakPtr;
+    template <typename Y, typename Mode>
+    friend class EnableSharedFromThis;
 
 public:
+    using ElementType = std::remove_extent_t<T>;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
@@ -23,12 +28,13 @@ public:
         }
     }
     template <class Y>
-    WeakPtr(const WeakPtr<Y>& other) : block_(other.block_), observer_(other.observer_) {
+    requires IsCompatiblePointer<Y, T>::value WeakPtr(const WeakPtr<Y>& other)
+        : block_(other.block_), observer_(other.observer_) {
         if (block_ != nullptr) {
             block_->IncWeakCounter();
         }
     }
-    WeakPtr(WeakPtr&& other) : block_(other.block_), observer_(other.observer_) {
+    WeakPtr(WeakPtr&& other) noexcept : block_(other.block_), observer_(other.observer_) {
         other.block_ = nullptr;
         other.observer_ = nullptr;
     }
@@ -36,7 +42,8 @@ public:
     // Demote `SharedPtr`
     // #2 from https://en.cppreference.com/w/cpp/memory/weak_ptr/weak_ptr
     template <class Y>
-    WeakPtr(const SharedPtr<Y>& other) : block_(other.block_), observer_(other.observer_) {
+    requires IsCompatiblePointer<Y, T>::value WeakPtr(const SharedPtr<Y>& other)
+        : block_(other.block_), observer_(other.observer_) {
         if (block_ != nullptr) {
             block_->IncWeakCounter();
         }
@@ -56,14 +63,8 @@ public:
         }
         return *this;
     }
-    WeakPtr& operator=(WeakPtr&& other) {
-        if (block_ != nullptr) {
-            block_->DecWeakCounter();
-        }
-        block_ = other.block_;
-        observer_ = other.observer_;
-        other.block_ = nullptr;
-        other.observer_ = nullptr;
+    WeakPtr& operator=(WeakPtr&& other) noexcept {
+        WeakPtr(std::move(other)).Swap(*this);
         return *this;
     }
 
@@ -86,7 +87,7 @@ public:
             observer_ = nullptr;
         }
     }
-    void Swap(WeakPtr& other) {
+    void Swap(WeakPtr& other) noexcept {
         std::swap(block_, other.block_);
         std::swap(observer_, other.observer_);
     }
@@ -104,13 +105,18 @@ public:
         return block_ == nullptr || block_->GetStrongCounter() == 0;
     }
     SharedPtr<T> Lock() const {
-        if (!Expired()) {
-            return SharedPtr<T>(*this);
+        SharedPtr<T> result;
+        if (block_ != nullptr && block_->IncStrongCounterIfNotZero()) {
+            result.block_ = block_;
+            result.observer_ = observer_;
         }
-        return SharedPtr<T>();
+        return result;
     }
 
 private:
     BaseBlock* block_;
-    T* observer_;
+    ElementType* observer_;
 };
+
+template <typename T>
+struct IsTriviallyRelocatable<WeakPtr<T>> : std::true_type {};